@@ -0,0 +1,1342 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * Pre-analysis of function bodies. When make_function() makes a named lambda
+ * or mu function, the body is turned into a tree of nodes, each with the C
+ * function that evaluates it, so apply() need not dispatch on the type of
+ * each form again. Constants are resolved in advance, the special forms quote,
+ * if, cond, and, or, progn, while, setq, let, and let* get nodes of their own,
+ * and the number of arguments of a builtin call is checked only once.
+ *
+ * The function a node calls is looked up on the first evaluation and cached
+ * in the node, together with the function_epoch it was found in; as
+ * set_function() increments the epoch whenever a function cell changes, an
+ * outdated cache entry is noticed and the function is looked up again. This is
+ * also how a special form node notices that its symbol has been redefined.
+ * Whatever the nodes do not handle, like calls of macros, of lambda forms, or
+ * of traced functions, is left to evalfun(). Calls of lambda and bytecode
+ * functions in tail position are left to apply(), which makes them in a loop.
+ *
+ * The nodes refer to the forms they were made from; these are kept in a vector
+ * in the code field of the function, so they stay alive even if the lambda
+ * form is modified.
+ *
+ * A function defined while lexical-binding is non-nil, or with (declare
+ * (lexical)) as the first form of its body, is lexical: its parameters and let
+ * variables live in frames of lexical variables (ENVIRON objects) that are
+ * resolved to a depth and slot here, and lambda forms in it make closures over
+ * the current frame. Variables declared with (declare (special var ...)) are
+ * bound dynamically, and so are those that occur in a form left to evalfun(),
+ * which could not see them otherwise. A call or special form is left to
+ * evalfun() only at run time if its symbol has become a macro or another
+ * function since; then the lexical variables occurring in it are bound
+ * dynamically to their values for the time, and their values copied back.
+ */
+
+#include "cbasics.h"
+#include <string.h>
+#include "objects.h"
+#include "names.h"
+#include "analyze.h"
+#include "builtins.h"
+#include "eval.h"
+#include "printer.h"
+#include "signals.h"
+#include "xmemory.h"
+#include "gc.h"
+
+typedef obp_t node_func_t(struct NODE *node, session_context_t *sc, int level);
+
+/* A node of an analyzed function body. The level passed to the node functions
+ * is that eval() would have been called with for the form.
+ */
+typedef struct NODE {
+        node_func_t *run;               /* evaluate the node */
+        obp_t form;                     /* the form analyzed */
+        obp_t ob;                       /* constant value or variable */
+        builtin_func_t *builtin;        /* builtin of a special form */
+        obp_t fun;                      /* cached function, or 0 */
+        ulong epoch;                    /* function_epoch of the cache; 0 if
+                                           there is none yet */
+        uint nbind;                     /* number of let bindings or
+                                           parameters, which are the first
+                                           subnodes */
+        uint nslots;                    /* number of lexical variables they
+                                           bind */
+        uint depth;                     /* frames out to a lexical variable */
+        int slot;                       /* its index in the frame, or -1 if
+                                           the variable is special */
+        uint nkids;                     /* number of subnodes */
+        struct NODE **kids;             /* subnodes */
+        uint nrefs;                     /* number of variable references */
+        struct NODE **refs;             /* the lexical variables occurring in
+                                           the form, for node_evalfun() */
+} node_t;
+
+/* The lexical variables of a let or function during the analysis; a scope
+ * with variables has a frame at run time.
+ */
+typedef struct SCOPE {
+        struct SCOPE *outer;            /* the enclosing scope, or 0 */
+        obp_t *vars;                    /* the variables in slot order */
+        uint nvars;                     /* number of variables */
+        uint nvisible;                  /* how many are bound yet (let*) */
+} scope_t;
+
+typedef struct ANALYSIS {
+        obp_t *forms;                   /* the forms the nodes are made from */
+        uint nforms;
+        uint size;
+        int lexical;                    /* analyzing a lexical function */
+        scope_t *scope;                 /* the innermost scope, or 0 */
+        obp_t specials;                 /* variables bound dynamically */
+        int escaped;                    /* a lexical variable was found in a
+                                           form left to evalfun() */
+        obp_t templates;                /* functions of inner lambda forms */
+} analysis_t;
+
+obp_t lexical_env;
+
+builtin_func_t bf_quote, bf_if, bf_cond, bf_and, bf_or, bf_progn, bf_while,
+        bf_setq, bf_let, bf_letrec, bf_lambda, bf_function;
+
+static node_func_t node_quote, node_if, node_cond, node_and, node_or,
+        node_progn, node_while, node_setq, node_let, node_letrec, node_closure;
+
+static struct {
+        builtin_func_t *builtin;
+        node_func_t *run;
+} special_forms[] = {
+        { bf_quote, node_quote },
+        { bf_if, node_if },
+        { bf_cond, node_cond },
+        { bf_and, node_and },
+        { bf_or, node_or },
+        { bf_progn, node_progn },
+        { bf_while, node_while },
+        { bf_setq, node_setq },
+        { bf_let, node_let },
+        { bf_letrec, node_letrec },
+        { bf_lambda, node_closure },
+        { bf_function, node_closure },
+        { 0, 0 }
+};
+
+
+/**
+ * Print the form of a node that has returned an error or a throw, as eval()
+ * does for its backtrace.
+ */
+static void backtrace(node_t *n, obp_t value, session_context_t *sc,
+                      int level)
+{
+        PROTECT;
+        PROTVAL(signal, value);
+
+        port_printf(sc->out, "#%d: ", level);
+        print_expr(n->form, sc->out);
+        terpri(sc->out);
+        UNPROTECT;
+}
+
+static obp_t eval_node(node_t *n, session_context_t *sc, int level)
+{
+        obp_t value = n->run(n, sc, level);
+
+        if (IS_EXIT(value) && IS(n->form, PAIR)) {
+                backtrace(n, value, sc, level);
+        }
+        return value;
+}
+
+/**
+ * Evaluate the subnodes from index `from' on in sequence and return the value
+ * of the last one, or nil if there is none.
+ */
+static obp_t eval_seq(node_t *n, uint from, session_context_t *sc, int level)
+{
+        obp_t value = the_Nil;
+
+        for (uint i = from; i < n->nkids; i++) {
+                value = eval_node(n->kids[i], sc, level);
+                if (!value || IS_EXIT(value)) {
+                        break;
+                }
+        }
+        return value;
+}
+
+
+static obp_t node_const(node_t *n, session_context_t *sc, int level)
+{
+        return n->ob;
+}
+
+static obp_t node_variable(node_t *n, session_context_t *sc, int level)
+{
+        obp_t value = AS(n->ob, SYMBOL)->value;
+
+        if (!value) {
+                return throw_error(sc->out, ERR_EVAL, n->ob,
+                                   "symbol undefined");
+        }
+        return value;
+}
+
+/**
+ * Return the frame of lexical variables `depth' frames out from the current.
+ */
+static Lenviron_t *frame_at(uint depth)
+{
+        obp_t env = lexical_env;
+
+        while (depth-- > 0) {
+                env = AS(env, ENVIRON)->parent;
+        }
+        return AS(env, ENVIRON);
+}
+
+static obp_t node_lexvar(node_t *n, session_context_t *sc, int level)
+{
+        return frame_at(n->depth)->slot[n->slot];
+}
+
+static obp_t node_evalfun(node_t *n, session_context_t *sc, int level)
+{
+        obp_t macro = macro_of(n->form);
+        uint depth = specpdl_top;
+        obp_t retval;
+
+        for (uint i = 0; i < n->nrefs; i++) {
+                specbind(n->refs[i]->ob, node_lexvar(n->refs[i], sc, level));
+        }
+        if (macro) {
+                retval = eval_macro(n->form, macro, sc, level + 1, 0);
+        } else {
+                retval = evalfun(CAR(n->form), CDR(n->form), sc, level + 1);
+        }
+        for (uint i = 0; i < n->nrefs; i++) {
+                node_t *r = n->refs[i];
+                Lenviron_t *env = frame_at(r->depth);
+                env->slot[r->slot] = AS(r->ob, SYMBOL)->value;
+                gc_write_barrier((obp_t) env, env->slot[r->slot]);
+        }
+        unbind_to(depth);
+        return retval;
+}
+
+/**
+ * Return non-zero iff the symbol of a special form node still has the builtin
+ * function the node was made for.
+ */
+static int still_special(node_t *n)
+{
+        if (n->epoch != function_epoch) {
+                obp_t fun = AS(CAR(n->form), SYMBOL)->function;
+                if (fun && IS_BUILTIN(fun) && !AS(fun, FUNCTION)->trace
+                    && !AS(fun, FUNCTION)->argv
+                    && AS(fun, FUNCTION)->impl.builtin == n->builtin) {
+                        n->fun = fun;
+                } else {
+                        n->fun = 0;
+                }
+                n->epoch = function_epoch;
+        }
+        return n->fun != 0;
+}
+
+static obp_t node_quote(node_t *n, session_context_t *sc, int level)
+{
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        return n->ob;
+}
+
+static obp_t node_if(node_t *n, session_context_t *sc, int level)
+{
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        if (n->nkids == 0) {
+                return the_Nil;
+        }
+        obp_t cond = eval_node(n->kids[0], sc, level + 1);
+        if (!cond || IS_EXIT(cond)) {
+                return cond;
+        }
+        if (!IS_NIL(cond)) {
+                if (n->nkids < 2) {
+                        return the_Nil;
+                }
+                return eval_node(n->kids[1], sc, level + 1);
+        }
+        return eval_seq(n, 2, sc, level + 1);
+}
+
+static obp_t node_cond(node_t *n, session_context_t *sc, int level)
+{
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        for (uint i = 0; i < n->nkids; i++) {
+                node_t *clause = n->kids[i];
+                obp_t value = eval_node(clause->kids[0], sc, level + 1);
+                if (!value || IS_EXIT(value)) {
+                        return value;
+                }
+                if (!IS_NIL(value)) {
+                        if (clause->nkids == 1) {
+                                return value;
+                        }
+                        return eval_seq(clause, 1, sc, level + 1);
+                }
+        }
+        return the_Nil;
+}
+
+static obp_t node_and(node_t *n, session_context_t *sc, int level)
+{
+        obp_t value = the_T;
+
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        for (uint i = 0; i < n->nkids; i++) {
+                value = eval_node(n->kids[i], sc, level + 1);
+                if (!value || IS_EXIT(value) || IS_NIL(value)) {
+                        break;
+                }
+        }
+        return value;
+}
+
+static obp_t node_or(node_t *n, session_context_t *sc, int level)
+{
+        obp_t value = the_Nil;
+
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        for (uint i = 0; i < n->nkids; i++) {
+                value = eval_node(n->kids[i], sc, level + 1);
+                if (!value || IS_EXIT(value) || !IS_NIL(value)) {
+                        break;
+                }
+        }
+        return value;
+}
+
+static obp_t node_progn(node_t *n, session_context_t *sc, int level)
+{
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        return eval_seq(n, 0, sc, level + 1);
+}
+
+static obp_t node_while(node_t *n, session_context_t *sc, int level)
+{
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        while (1) {
+                obp_t value = eval_node(n->kids[0], sc, level + 1);
+                if (!value || IS_EXIT(value) || IS_NIL(value)) {
+                        return value;
+                }
+                for (uint i = 1; i < n->nkids; i++) {
+                        value = eval_node(n->kids[i], sc, level + 1);
+                        if (!value || IS_EXIT(value)) {
+                                return value;
+                        }
+                }
+        }
+}
+
+/**
+ * Each symbol to set is a subnode with the variable and the value form as
+ * subnode.
+ */
+static obp_t node_setq(node_t *n, session_context_t *sc, int level)
+{
+        obp_t value = the_Nil;
+
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        for (uint i = 0; i < n->nkids; i++) {
+                node_t *target = n->kids[i];
+                obp_t sym = target->ob;
+                if (sym->immutable) {
+                        return throw_error(sc->out, ERR_IMMUTBL, sym,
+                                           "symbol value may not be modified");
+                }
+                value = eval_node(target->kids[0], sc, level + 1);
+                if (!value || IS_EXIT(value)) {
+                        return value;
+                }
+                if (target->slot >= 0) {
+                        Lenviron_t *frame = frame_at(target->depth);
+                        frame->slot[target->slot] = value;
+                        gc_write_barrier((obp_t) frame, value);
+                } else {
+                        AS(sym, SYMBOL)->value = value;
+                        gc_write_barrier(sym, value);
+                }
+        }
+        return value;
+}
+
+/**
+ * Bind the variable of a let binding node to a value, in the current frame of
+ * lexical variables or on the special binding stack.
+ */
+static void bind_variable(node_t *b, obp_t value)
+{
+        if (b->slot >= 0) {
+                AS(lexical_env, ENVIRON)->slot[b->slot] = value;
+                gc_write_barrier(lexical_env, value);
+        } else {
+                specbind(b->ob, value);
+        }
+        bind_count++;
+}
+
+/**
+ * Evaluate let or, if sequential, let*. Each binding is a subnode with the
+ * symbol and, unless the symbol is bound to nil, the value form as subnode.
+ * As in bf_let(), the values of let are bound from the last to the first.
+ * Lexical variables go into a new frame, which let* makes before evaluating
+ * the values, so closures made there see the variables bound later.
+ */
+static obp_t run_let(node_t *n, int sequential, session_context_t *sc,
+                     int level)
+{
+        PROTECT;
+        PROTVAR(retval);
+        PROTVAR(values);
+        PROTVAL(saved_env, lexical_env);
+        uint depth = specpdl_top;
+
+        if (sequential && n->nslots) {
+                lexical_env = new_environ(n->nslots, lexical_env);
+        }
+        for (uint i = 0; i < n->nbind; i++) {
+                node_t *binding = n->kids[i];
+                if (binding->nkids) {
+                        retval = eval_node(binding->kids[0], sc, level + 1);
+                        CHECK_ERROR(retval);
+                } else {
+                        retval = the_Nil;
+                }
+                if (sequential) {
+                        bind_variable(binding, retval);
+                } else {
+                        values = new_pair(retval, values);
+                }
+        }
+        if (!sequential) {
+                if (n->nslots) {
+                        lexical_env = new_environ(n->nslots, lexical_env);
+                }
+                for (uint i = n->nbind; i > 0; i--) {
+                        bind_variable(n->kids[i - 1], CAR(values));
+                        values = CDR(values);
+                }
+        }
+        retval = eval_seq(n, n->nbind, sc, level + 1);
+    EXIT:
+        lexical_env = saved_env;
+        restore_bindings(depth, sc, level + 1);
+        UNPROTECT;
+        return retval;
+}
+
+static obp_t node_let(node_t *n, session_context_t *sc, int level)
+{
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        return run_let(n, 0, sc, level);
+}
+
+static obp_t node_letrec(node_t *n, session_context_t *sc, int level)
+{
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        return run_let(n, 1, sc, level);
+}
+
+/**
+ * Make a closure over the current frame of lexical variables from the function
+ * of a lambda form, which has been made and analyzed in advance.
+ */
+static obp_t node_closure(node_t *n, session_context_t *sc, int level)
+{
+        if (!still_special(n)) {
+                return node_evalfun(n, sc, level);
+        }
+        Lfunction_t *templ = AS(n->ob, FUNCTION);
+        obp_t fun = new_form_function(0, 0, templ->impl.form, templ->is_special,
+                                      templ->minargs, templ->maxargs);
+        Lfunction_t *func = AS(fun, FUNCTION);
+        func->code = n->ob;
+        gc_write_barrier(fun, n->ob);
+        func->env = lexical_env;
+        gc_write_barrier(fun, lexical_env);
+        func->lexical = 1;
+        return fun;
+}
+
+/**
+ * Look up the function of a call node and cache it; return 0 if the call must
+ * be left to evalfun().
+ */
+static obp_t resolve_call(node_t *n)
+{
+        obp_t fun = AS(CAR(n->form), SYMBOL)->function;
+
+        if (fun && IS(fun, FUNCTION)) {
+                Lfunction_t *func = AS(fun, FUNCTION);
+                if (func->is_special || func->trace
+                    || func->type == F_AUTOLOAD) {
+                        fun = 0;
+                } else if (func->type == F_BUILTIN
+                           && (n->nkids < func->minargs
+                               || (func->maxargs >= 0
+                                   && n->nkids > func->maxargs))) {
+                        fun = 0;        /* let evalfun() report it */
+                }
+        } else {
+                fun = 0;
+        }
+        n->fun = fun;
+        n->epoch = function_epoch;
+        return fun;
+}
+
+/**
+ * Call a builtin taking an argument vector, evaluating the arguments onto the
+ * value stack.
+ */
+static obp_t call_argv(node_t *n, obp_t fun, session_context_t *sc, int level)
+{
+        PROTECT;
+        PROTVAL(func, fun);
+        PROTVAR(retval);
+        uint base = reserve_values(n->nkids);
+
+        for (uint i = 0; i < n->nkids; i++) {
+                retval = eval_node(n->kids[i], sc, level + 1);
+                CHECK_ERROR(retval);
+                value_stack[base + i] = retval;
+        }
+        apply_count++;
+        retval = AS(func, FUNCTION)->impl.builtin_argv(n->nkids,
+                                                       value_stack + base,
+                                                       sc, level + 1);
+    EXIT:
+        value_stack_top = base;
+        UNPROTECT;
+        return retval;
+}
+
+/**
+ * Evaluate the subnodes of a call node into a list of arguments.
+ */
+static obp_t eval_args(node_t *n, session_context_t *sc, int level)
+{
+        PROTECT;
+        PROTVAR(args);
+        PROTVAR(last);                  /* last element of list */
+        PROTVAR(value);
+
+        for (uint i = 0; i < n->nkids; i++) {
+                value = eval_node(n->kids[i], sc, level + 1);
+                if (!value || IS_EXIT(value)) {
+                        args = value;
+                        break;
+                }
+                if (args == the_Nil) {
+                        args = last = new_pair(value, the_Nil);
+                } else {
+                        obp_t p = new_pair(value, the_Nil);
+                        CDR(last) = p;
+                        gc_write_barrier(last, p);
+                        last = p;
+                }
+        }
+        UNPROTECT;
+        return args;
+}
+
+/**
+ * Call a traced function with the arguments evaluated from the subnodes, which
+ * may refer to lexical variables evalfun() would not see.
+ */
+static obp_t call_traced(node_t *n, session_context_t *sc, int level)
+{
+        PROTECT;
+        PROTVAR(retval);
+
+        retval = eval_args(n, sc, level);
+        CHECK_ERROR(retval);
+        retval = funcall_values(CAR(n->form), retval, sc, level + 1);
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+static obp_t node_call(node_t *n, session_context_t *sc, int level)
+{
+        obp_t fun = n->epoch == function_epoch ? n->fun : resolve_call(n);
+
+        if (!fun) {
+                fun = AS(CAR(n->form), SYMBOL)->function;
+                if (fun && IS(fun, FUNCTION) && AS(fun, FUNCTION)->trace
+                    && !AS(fun, FUNCTION)->is_special) {
+                        return call_traced(n, sc, level);
+                }
+                return node_evalfun(n, sc, level);
+        }
+        if (AS(fun, FUNCTION)->argv) {
+                return call_argv(n, fun, sc, level);
+        }
+        PROTECT;
+        PROTVAL(func, fun);
+        PROTVAR(retval);
+        PROTVAR(args);                  /* evaluated arguments */
+
+        args = eval_args(n, sc, level);
+        CHECK_ERROR(args);
+        if (IS_BUILTIN(func)) {
+                apply_count++;
+                retval = AS(func, FUNCTION)->impl.builtin(n->nkids, args, sc,
+                                                          level + 1);
+        } else {
+                retval = apply(func, args, sc, level + 1);
+        }
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+static obp_t eval_tail(node_t *n, session_context_t *sc, int level,
+                       tail_call_t *tail);
+
+/**
+ * As eval_seq(), but evaluate the last subnode in tail position.
+ */
+static obp_t eval_seq_tail(node_t *n, uint from, session_context_t *sc,
+                           int level, tail_call_t *tail)
+{
+        obp_t value = the_Nil;
+
+        for (uint i = from; i < n->nkids; i++) {
+                if (i == n->nkids - 1) {
+                        return eval_tail(n->kids[i], sc, level, tail);
+                }
+                value = eval_node(n->kids[i], sc, level);
+                if (!value || IS_EXIT(value)) {
+                        break;
+                }
+        }
+        return value;
+}
+
+/**
+ * Evaluate a node in tail position, like eval_node(). A call of a lambda or
+ * bytecode function, also as the taken branch of if, cond, or progn or as the
+ * expansion of a macro, is not made, but stored in *tail for apply() to make;
+ * see eval_tail() in eval.c.
+ */
+static obp_t eval_tail(node_t *n, session_context_t *sc, int level,
+                       tail_call_t *tail)
+{
+        obp_t value;
+        obp_t fun;
+
+        if (n->run == node_if && still_special(n) && n->nkids > 0) {
+                value = eval_node(n->kids[0], sc, level + 1);
+                if (value && !IS_EXIT(value)) {
+                        if (IS_NIL(value)) {
+                                value = eval_seq_tail(n, 2, sc, level + 1,
+                                                      tail);
+                        } else if (n->nkids < 2) {
+                                value = the_Nil;
+                        } else {
+                                value = eval_tail(n->kids[1], sc, level + 1,
+                                                  tail);
+                        }
+                }
+        } else if (n->run == node_cond && still_special(n)) {
+                value = the_Nil;
+                for (uint i = 0; i < n->nkids; i++) {
+                        node_t *clause = n->kids[i];
+                        value = eval_node(clause->kids[0], sc, level + 1);
+                        if (!value || IS_EXIT(value)) {
+                                break;
+                        }
+                        if (!IS_NIL(value)) {
+                                if (clause->nkids > 1) {
+                                        value = eval_seq_tail(clause, 1, sc,
+                                                              level + 1, tail);
+                                }
+                                break;
+                        }
+                }
+        } else if (n->run == node_progn && still_special(n)) {
+                value = eval_seq_tail(n, 0, sc, level + 1, tail);
+        } else if (n->run == node_evalfun && (fun = macro_of(n->form))) {
+                value = eval_macro(n->form, fun, sc, level + 1, tail);
+        } else if (n->run == node_call
+                   && (fun = n->epoch == function_epoch ? n->fun
+                       : resolve_call(n))
+                   && !IS_BUILTIN(fun)) {
+                value = eval_args(n, sc, level);
+                if (value && !IS_EXIT(value)) {
+                        tail->fun = fun;
+                        tail->args = value;
+                        value = the_Nil;
+                }
+        } else {
+                return eval_node(n, sc, level);
+        }
+        if (value && IS_EXIT(value)) {
+                backtrace(n, value, sc, level);
+        }
+        return value;
+}
+
+
+/**
+ * Keep an object alive with the function analyzed.
+ */
+static void keep(analysis_t *a, obp_t ob)
+{
+        if (a->nforms >= a->size) {
+                a->size = a->size ? 2 * a->size : 32;
+                a->forms = xrealloc(a->forms, a->size * sizeof(obp_t),
+                                    "analysis forms");
+        }
+        a->forms[a->nforms++] = ob;
+}
+
+/**
+ * Return a vector of the objects kept so far, and free their array.
+ */
+static obp_t kept_vector(analysis_t *a)
+{
+        obp_t vec = new_vector(a->nforms);
+        Lvector_t *v = AS(vec, VECTOR);
+
+        memcpy(v->elem, a->forms, a->nforms * sizeof(obp_t));
+        v->nelem = a->nforms;
+        xfree(a->forms);
+        a->forms = 0;
+        a->nforms = a->size = 0;
+        return vec;
+}
+
+static node_t *new_node(analysis_t *a, obp_t form, node_func_t *run,
+                        uint nkids)
+{
+        node_t *n = xmalloc(sizeof(node_t), "analysis node");
+
+        memset(n, 0, sizeof(node_t));
+        n->run = run;
+        n->form = form;
+        n->slot = -1;
+        n->nkids = nkids;
+        if (nkids) {
+                n->kids = xmalloc(nkids * sizeof(node_t *), "analysis node");
+        }
+        keep(a, form);
+        return n;
+}
+
+/**
+ * Return non-zero iff a symbol is member of a list.
+ */
+static int memq(obp_t sym, obp_t list)
+{
+        for ( ; IS(list, PAIR); list = CDR(list)) {
+                if (CAR(list) == sym) {
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+/**
+ * Return non-zero iff a variable bound by the function analyzed is to be bound
+ * on the special binding stack.
+ */
+static int is_special(analysis_t *a, obp_t sym)
+{
+        return !a->lexical || sym->immutable || sym == the_Lexical_binding
+                || memq(sym, a->specials);
+}
+
+/**
+ * Return the slot of a lexical variable visible in the current scope and set
+ * *depth to the number of frames out to it, or return -1 if the variable is
+ * not lexical.
+ */
+static int resolve(analysis_t *a, obp_t sym, uint *depth)
+{
+        *depth = 0;
+        for (scope_t *s = a->scope; s; s = s->outer) {
+                for (uint i = s->nvisible; i > 0; i--) {
+                        if (s->vars[i - 1] == sym) {
+                                return i - 1;
+                        }
+                }
+                (*depth)++;
+        }
+        return -1;
+}
+
+/**
+ * Make a node binding a variable and, unless it is special, give it the next
+ * slot of a scope.
+ */
+static node_t *binding_node(analysis_t *a, obp_t form, obp_t sym,
+                            scope_t *scope, uint nkids)
+{
+        node_t *b = new_node(a, form, 0, nkids);
+
+        b->ob = sym;
+        if (!is_special(a, sym)) {
+                b->slot = scope->nvars;
+                scope->vars[scope->nvars++] = sym;
+        }
+        return b;
+}
+
+/**
+ * Make the lexical variables occurring in a form left to evalfun() special, as
+ * the form can see only the special binding; analyze_function() then analyzes
+ * the function again.
+ */
+static void note_escapes(analysis_t *a, obp_t form)
+{
+        uint depth;
+
+        while (IS(form, PAIR)) {
+                note_escapes(a, CAR(form));
+                form = CDR(form);
+        }
+        if (IS(form, SYMBOL) && resolve(a, form, &depth) >= 0) {
+                a->specials = new_pair(form, a->specials);
+                a->escaped = 1;
+        }
+}
+
+/**
+ * Give a node of a lexical function, which may still be left to evalfun() at
+ * run time, a variable node for each lexical variable occurring in its form.
+ */
+static void note_refs(analysis_t *a, node_t *n, obp_t form)
+{
+        uint depth;
+        int slot;
+
+        while (IS(form, PAIR)) {
+                note_refs(a, n, CAR(form));
+                form = CDR(form);
+        }
+        if (!IS(form, SYMBOL) || (slot = resolve(a, form, &depth)) < 0) {
+                return;
+        }
+        for (uint i = 0; i < n->nrefs; i++) {
+                if (n->refs[i]->ob == form) {
+                        return;
+                }
+        }
+        node_t *r = new_node(a, form, node_lexvar, 0);
+        r->ob = form;
+        r->slot = slot;
+        r->depth = depth;
+        n->refs = xrealloc(n->refs, (n->nrefs + 1) * sizeof(node_t *),
+                           "analysis node");
+        n->refs[n->nrefs++] = r;
+}
+
+/**
+ * Return the length of a proper list, or -1 if it is not one.
+ */
+static int proper_length(obp_t list)
+{
+        int length = 0;
+
+        for ( ; IS(list, PAIR); list = CDR(list)) {
+                length++;
+        }
+        return IS_NIL(list) ? length : -1;
+}
+
+static node_t *analyze_form(analysis_t *a, obp_t form);
+
+/**
+ * Make a node with the elements of a proper list as subnodes.
+ */
+static node_t *analyze_list(analysis_t *a, obp_t form, obp_t list,
+                            node_func_t *run)
+{
+        node_t *n = new_node(a, form, run, proper_length(list));
+
+        for (uint i = 0; i < n->nkids; i++) {
+                n->kids[i] = analyze_form(a, CAR(list));
+                list = CDR(list);
+        }
+        return n;
+}
+
+/**
+ * Make the node of a let or let* form; return 0 if a binding is malformed.
+ */
+static node_t *analyze_let(analysis_t *a, obp_t form, node_func_t *run)
+{
+        obp_t bindings = CADR(form);
+        obp_t body = CDR(CDR(form));
+        int nbind = proper_length(bindings);
+
+        if (nbind < 0) {
+                return 0;
+        }
+        for (obp_t b = bindings; IS(b, PAIR); b = CDR(b)) {
+                obp_t binding = CAR(b);
+                if (!IS(binding, SYMBOL)
+                    && !(IS(binding, PAIR) && IS(CAR(binding), SYMBOL)
+                         && IS(CDR(binding), PAIR)
+                         && IS_NIL(CDR(CDR(binding))))) {
+                        return 0;
+                }
+        }
+
+        node_t *n = new_node(a, form, run, nbind + proper_length(body));
+        scope_t scope = { a->scope, 0, 0, 0 };
+        n->nbind = nbind;
+        scope.vars = xmalloc((nbind + 1) * sizeof(obp_t), "analysis scope");
+        for (int i = 0; i < nbind; i++) {
+                obp_t binding = CAR(bindings);
+                if (IS(binding, SYMBOL)) {
+                        n->kids[i] = binding_node(a, binding, binding, &scope,
+                                                  0);
+                } else {
+                        n->kids[i] = binding_node(a, binding, CAR(binding),
+                                                  &scope, 1);
+                }
+                bindings = CDR(bindings);
+        }
+        n->nslots = scope.nvars;
+        /* let* makes its frame first and binds one variable after the other,
+         * let binds all of them in a new frame after evaluating the values
+         */
+        if (run == node_letrec && scope.nvars) {
+                a->scope = &scope;
+        }
+        bindings = CADR(form);
+        for (int i = 0; i < nbind; i++) {
+                node_t *b = n->kids[i];
+                if (b->nkids) {
+                        b->kids[0] = analyze_form(a, CADR(CAR(bindings)));
+                }
+                if (b->slot >= 0) {
+                        scope.nvisible = b->slot + 1;
+                }
+                bindings = CDR(bindings);
+        }
+        if (scope.nvars) {
+                a->scope = &scope;
+        }
+        for (uint i = nbind; i < n->nkids; i++) {
+                n->kids[i] = analyze_form(a, CAR(body));
+                body = CDR(body);
+        }
+        a->scope = scope.outer;
+        xfree(scope.vars);
+        return n;
+}
+
+static node_t *analyze_lexical(analysis_t *a, obp_t form,
+                               lambda_list_t *ll);
+
+/**
+ * Make the function of a lambda form in a lexical function, with its body
+ * analyzed in the current scope, as template of the closures node_closure()
+ * makes; return 0 if the form is malformed.
+ */
+static obp_t analyze_lambda(analysis_t *a, obp_t form)
+{
+        PROTECT;
+        PROTVAR(fun);
+        analysis_t outer = *a;
+        short minargs;
+        short maxargs;
+
+        if (check_form(form, &minargs, &maxargs)) {
+                goto EXIT;
+        }
+        fun = new_form_function(0, 0, form, CAR(form) == the_Mu, minargs,
+                                maxargs);
+        a->templates = new_pair(fun, a->templates);
+
+        /* the template keeps the forms of its own nodes */
+        a->forms = 0;
+        a->nforms = a->size = 0;
+        Lfunction_t *func = AS(fun, FUNCTION);
+        func->params = new_lambda_list(CADR(form));
+        node_t *tree = analyze_lexical(a, form, func->params);
+        func->code = kept_vector(a);
+        gc_write_barrier(fun, func->code);
+        func->tree = tree;
+        func->lexical = 1;
+        a->forms = outer.forms;
+        a->nforms = outer.nforms;
+        a->size = outer.size;
+        keep(a, fun);
+    EXIT:
+        UNPROTECT;
+        return fun;
+}
+
+/**
+ * Make the node of a special form; return 0 if the form is not one the
+ * analysis handles.
+ */
+static node_t *analyze_special(analysis_t *a, obp_t form, obp_t fun,
+                               int nargs)
+{
+        Lfunction_t *func = AS(fun, FUNCTION);
+        node_func_t *run = 0;
+        obp_t args = CDR(form);
+        node_t *n;
+
+        if (!IS_BUILTIN(fun) || func->argv || nargs < func->minargs
+            || (func->maxargs >= 0 && nargs > func->maxargs)) {
+                return 0;
+        }
+        for (int i = 0; special_forms[i].builtin; i++) {
+                if (special_forms[i].builtin == func->impl.builtin) {
+                        run = special_forms[i].run;
+                }
+        }
+        if (run == 0) {
+                return 0;
+        }
+        if (run == node_quote) {
+                n = new_node(a, form, run, 0);
+                n->ob = CAR(args);
+        } else if (run == node_cond) {
+                for (obp_t cl = args; IS(cl, PAIR); cl = CDR(cl)) {
+                        if (!IS(CAR(cl), PAIR) || proper_length(CAR(cl)) < 0) {
+                                return 0;
+                        }
+                }
+                n = new_node(a, form, run, nargs);
+                for (int i = 0; i < nargs; i++) {
+                        n->kids[i] = analyze_list(a, CAR(args), CAR(args), 0);
+                        args = CDR(args);
+                }
+        } else if (run == node_setq) {
+                if (nargs % 2 != 0) {
+                        return 0;
+                }
+                for (obp_t p = args; IS(p, PAIR); p = CDR(CDR(p))) {
+                        if (!IS(CAR(p), SYMBOL)) {
+                                return 0;
+                        }
+                }
+                n = new_node(a, form, run, nargs / 2);
+                for (int i = 0; i < nargs / 2; i++) {
+                        node_t *target = new_node(a, CAR(args), 0, 1);
+                        target->ob = CAR(args);
+                        target->slot = resolve(a, CAR(args), &target->depth);
+                        target->kids[0] = analyze_form(a, CADR(args));
+                        n->kids[i] = target;
+                        args = CDR(CDR(args));
+                }
+        } else if (run == node_let || run == node_letrec) {
+                if (!(n = analyze_let(a, form, run))) {
+                        return 0;
+                }
+        } else if (run == node_closure) {
+                /* (lambda ...) or (function (lambda ...)) */
+                obp_t lambda = func->impl.builtin == bf_lambda ? form
+                        : CAR(args);
+                obp_t templ;
+                if (!a->lexical || !IS(lambda, PAIR)
+                    || CAR(lambda) != the_Lambda
+                    || !(templ = analyze_lambda(a, lambda))) {
+                        return 0;
+                }
+                n = new_node(a, form, run, 0);
+                n->ob = templ;
+        } else {
+                n = analyze_list(a, form, args, run);
+        }
+        n->builtin = func->impl.builtin;
+        n->fun = fun;
+        n->epoch = function_epoch;
+        return n;
+}
+
+static node_t *analyze_form(analysis_t *a, obp_t form)
+{
+        node_t *n;
+
+        if (IS(form, SYMBOL)) {
+                obp_t value = AS(form, SYMBOL)->value;
+                uint depth;
+                int slot = resolve(a, form, &depth);
+                if (form->immutable && value) {
+                        n = new_node(a, form, node_const, 0);
+                        n->ob = value;
+                } else if (slot >= 0) {
+                        n = new_node(a, form, node_lexvar, 0);
+                        n->ob = form;
+                        n->slot = slot;
+                        n->depth = depth;
+                } else {
+                        n = new_node(a, form, node_variable, 0);
+                        n->ob = form;
+                }
+                return n;
+        }
+        if (!IS(form, PAIR)) {
+                n = new_node(a, form, node_const, 0);
+                n->ob = form;
+                return n;
+        }
+
+        obp_t head = CAR(form);
+        int nargs = proper_length(CDR(form));
+        if (IS(head, SYMBOL) && nargs >= 0) {
+                obp_t fun = AS(head, SYMBOL)->function;
+                if (fun == 0 || (!IS_SPECIAL(fun) && !IS_AUTOLOAD(fun))) {
+                        n = analyze_list(a, form, CDR(form), node_call);
+                } else if (!IS_SPECIAL(fun)
+                           || !(n = analyze_special(a, form, fun, nargs))) {
+                        n = 0;
+                }
+                if (n) {
+                        if (a->lexical) {
+                                note_refs(a, n, form);
+                        }
+                        return n;
+                }
+        }
+        if (a->lexical) {
+                note_escapes(a, form);
+        }
+        return new_node(a, form, node_evalfun, 0);
+}
+
+/**
+ * Make the root node of a lexical function: a subnode for each parameter of
+ * the lambda list, with the default value form of an optional parameter as
+ * subnode, then the nodes of the body in the scope of the parameters. As in
+ * let*, the parameters are bound one after the other, so a default value form
+ * sees the parameters before it.
+ */
+static node_t *analyze_lexical(analysis_t *a, obp_t form, lambda_list_t *ll)
+{
+        obp_t body = CDR(CDR(form));
+        uint nparams = ll->nreq + ll->nopt + ll->rest;
+
+        node_t *n = new_node(a, body, 0, nparams + proper_length(body));
+        scope_t scope = { a->scope, 0, 0, 0 };
+        n->nbind = nparams;
+        scope.vars = xmalloc((nparams + 1) * sizeof(obp_t), "analysis scope");
+        for (uint i = 0; i < nparams; i++) {
+                obp_t sym = ll->param[i].symbol;
+                n->kids[i] = binding_node(a, sym, sym, &scope,
+                                          ll->param[i].init != 0);
+        }
+        n->nslots = scope.nvars;
+        if (scope.nvars) {
+                a->scope = &scope;
+        }
+        for (uint i = 0; i < nparams; i++) {
+                node_t *param = n->kids[i];
+                if (param->nkids) {
+                        param->kids[0] = analyze_form(a, ll->param[i].init);
+                }
+                if (param->slot >= 0) {
+                        scope.nvisible = param->slot + 1;
+                }
+        }
+        for (uint i = nparams; i < n->nkids; i++) {
+                n->kids[i] = analyze_form(a, CAR(body));
+                body = CDR(body);
+        }
+        a->scope = scope.outer;
+        xfree(scope.vars);
+        return n;
+}
+
+/**
+ * Return non-zero iff a function is to be lexical: if lexical-binding is
+ * non-nil, or if the first form of its body is a declare form with a
+ * (lexical) declaration. Variables listed in a (special var ...) declaration
+ * there are added to the specials of the analysis.
+ */
+static int declared_lexical(analysis_t *a, obp_t form)
+{
+        obp_t body = CDR(CDR(form));
+        int lexical = !IS_NIL(AS(the_Lexical_binding, SYMBOL)->value);
+
+        if (!IS(body, PAIR) || !IS(CAR(body), PAIR)
+            || CAR(CAR(body)) != the_Declare) {
+                return lexical;
+        }
+        for (obp_t d = CDR(CAR(body)); IS(d, PAIR); d = CDR(d)) {
+                obp_t decl = CAR(d);
+                if (!IS(decl, PAIR)) {
+                        continue;
+                }
+                if (CAR(decl) == the_Lexical) {
+                        lexical = 1;
+                } else if (CAR(decl) == the_Special) {
+                        for (obp_t v = CDR(decl); IS(v, PAIR); v = CDR(v)) {
+                                if (IS(CAR(v), SYMBOL)) {
+                                        a->specials = new_pair(CAR(v),
+                                                               a->specials);
+                                }
+                        }
+                }
+        }
+        return lexical;
+}
+
+
+/**
+ * A lexical function is analyzed again as long as the analysis finds lexical
+ * variables that have to be special after all.
+ */
+void analyze_function(obp_t fun)
+{
+        PROTECT;
+        Lfunction_t *func = AS(fun, FUNCTION);
+        analysis_t analysis;
+        obp_t form = func->impl.form;
+        obp_t body = CDR(CDR(form));
+        node_t *tree;
+
+        assert(func->type == F_FORM);
+        memset(&analysis, 0, sizeof(analysis));
+        analysis.specials = analysis.templates = the_Nil;
+        protect(analysis.specials);
+        protect(analysis.templates);
+        analysis.lexical = declared_lexical(&analysis, form);
+        if (analysis.lexical) {
+                while (1) {
+                        analysis.escaped = 0;
+                        tree = analyze_lexical(&analysis, form,
+                                               func->params);
+                        if (!analysis.escaped) {
+                                break;
+                        }
+                        free_tree(tree);
+                        xfree(analysis.forms);
+                        analysis.forms = 0;
+                        analysis.nforms = analysis.size = 0;
+                        analysis.templates = the_Nil;
+                }
+        } else {
+                tree = analyze_list(&analysis, body, body, 0);
+        }
+        func->code = kept_vector(&analysis);
+        gc_write_barrier(fun, func->code);
+        func->tree = tree;
+        func->lexical = analysis.lexical;
+        UNPROTECT;
+}
+
+
+obp_t run_analyzed(obp_t fun, session_context_t *sc, int level,
+                   tail_call_t *tail)
+{
+        return eval_seq_tail(AS(fun, FUNCTION)->tree, 0, sc, level, tail);
+}
+
+
+obp_t run_lexical(obp_t fun, obp_t args, uint merge_from,
+                  session_context_t *sc, int level, tail_call_t *tail)
+{
+        PROTECT;
+        PROTVAR(retval);
+        Lfunction_t *func = AS(fun, FUNCTION);
+        int nargs = 0;
+
+        protect(args);
+        if (!func->tree) {
+                /* a closure runs the tree of its template */
+                func = AS(func->code, FUNCTION);
+        }
+        node_t *tree = func->tree;
+        uint nfixed = func->params->nreq + func->params->nopt;
+        for (obp_t a = args; IS(a, PAIR); a = CDR(a)) {
+                nargs++;
+        }
+        if (nargs < func->minargs) {
+                ERROR(sc->out, ERR_NOARGS, 0,
+                      "too few arguments for function");
+        }
+        if (func->maxargs >= 0 && nargs > func->maxargs) {
+                ERROR(sc->out, ERR_NOARGS, 0,
+                      "too many arguments for function");
+        }
+        if (tree->nslots) {
+                lexical_env = new_environ(tree->nslots,
+                                          AS(fun, FUNCTION)->env);
+        } else {
+                lexical_env = AS(fun, FUNCTION)->env;
+        }
+        for (uint i = 0; i < tree->nbind; i++) {
+                node_t *param = tree->kids[i];
+                if (i >= nfixed) {
+                        retval = args;  /* the rest parameter */
+                } else if (IS(args, PAIR)) {
+                        retval = CAR(args);
+                        args = CDR(args);
+                } else if (param->nkids) {
+                        retval = eval_node(param->kids[0], sc, level + 1);
+                        CHECK_ERROR(retval);
+                } else {
+                        retval = the_Nil;
+                }
+                if (param->slot >= 0) {
+                        AS(lexical_env, ENVIRON)->slot[param->slot] = retval;
+                        gc_write_barrier(lexical_env, retval);
+                        bind_count++;
+                } else {
+                        bind_param(param->ob, retval, merge_from);
+                }
+        }
+        retval = eval_seq_tail(tree, tree->nbind, sc, level, tail);
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+
+void free_tree(node_t *tree)
+{
+        for (uint i = 0; i < tree->nkids; i++) {
+                free_tree(tree->kids[i]);
+        }
+        for (uint i = 0; i < tree->nrefs; i++) {
+                free_tree(tree->refs[i]);
+        }
+        xfree(tree->refs);
+        xfree(tree->kids);
+        xfree(tree);
+}
+
+/* EOF */
@@ -0,0 +1,48 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * Pre-analysis of function bodies into trees of evaluation nodes
+ */
+
+#ifndef __ANALYZE_H_INC
+#define __ANALYZE_H_INC
+
+#include "cbasics.h"
+#include "objects.h"
+
+struct TAIL_CALL;
+
+/* the frame of lexical variables of the code running now, or 0 */
+extern obp_t lexical_env;
+
+/**
+ * Analyze the body of a lambda or mu function and attach the resulting tree
+ * to the function.
+ */
+void analyze_function(obp_t fun);
+
+/**
+ * Evaluate the analyzed body of a function, with the parameters already
+ * bound, and return the value. A call of a Lisp function in tail position is
+ * not made, but stored in *tail for apply() to make.
+ */
+obp_t run_analyzed(obp_t fun, session_context_t *sc, int level,
+                   struct TAIL_CALL *tail);
+
+/**
+ * Apply a lexical function to a list of arguments: bind the parameters in a
+ * new frame of lexical variables, or on the special binding stack (merged
+ * from index merge_from on, see bind_params()) if they are special, and
+ * evaluate the body as run_analyzed() does. The caller restores lexical_env.
+ */
+obp_t run_lexical(obp_t fun, obp_t args, uint merge_from,
+                  session_context_t *sc, int level, struct TAIL_CALL *tail);
+
+/**
+ * Free the analyzed body of a function.
+ */
+void free_tree(struct NODE *tree);
+
+
+#endif  /* __ANALYZE_H_INC */
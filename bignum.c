@@ -0,0 +1,554 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * Arbitrary-precision integers: sign and magnitude, with the magnitude in
+ * 32-bit digits so that a product of two digits fits in 64 bits.
+ * Multiplication switches from the school method to Karatsuba's above
+ * BIGNUM_KARATSUBA_DIGITS, division is Knuth's algorithm D.
+ */
+
+#include "cbasics.h"
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "bignum.h"
+#include "xmemory.h"
+
+typedef uint32_t digit_t;
+typedef uint64_t ddigit_t;
+
+#define DIGIT_BITS 32
+#define DECIMAL_BASE 1000000000        /* largest power of 10 in a digit */
+#define DECIMAL_DIGITS 9
+
+
+static digit_t *new_digits(uint n)
+{
+        return xmalloc((n ? n : 1) * sizeof(digit_t), "bignum digits");
+}
+
+/* the number of digits without leading zero digits */
+static uint mag_len(const digit_t *a, uint n)
+{
+        while (n && !a[n - 1]) {
+                n--;
+        }
+        return n;
+}
+
+static int mag_cmp(const digit_t *a, uint an, const digit_t *b, uint bn)
+{
+        if (an != bn) {
+                return an < bn ? -1 : 1;
+        }
+        while (an--) {
+                if (a[an] != b[an]) {
+                        return a[an] < b[an] ? -1 : 1;
+                }
+        }
+        return 0;
+}
+
+/* r += a, with an <= rn; the sum must fit in rn digits */
+static void mag_add_into(digit_t *r, uint rn, const digit_t *a, uint an)
+{
+        ddigit_t carry = 0;
+        uint i;
+
+        for (i = 0; i < an; i++) {
+                carry += (ddigit_t) r[i] + a[i];
+                r[i] = (digit_t) carry;
+                carry >>= DIGIT_BITS;
+        }
+        for (; carry && i < rn; i++) {
+                carry += r[i];
+                r[i] = (digit_t) carry;
+                carry >>= DIGIT_BITS;
+        }
+}
+
+/* r -= a, with an <= rn and a <= r */
+static void mag_sub_into(digit_t *r, uint rn, const digit_t *a, uint an)
+{
+        digit_t borrow = 0;
+        uint i;
+
+        for (i = 0; i < an; i++) {
+                ddigit_t d = (ddigit_t) r[i] - a[i] - borrow;
+                r[i] = (digit_t) d;
+                borrow = (d >> DIGIT_BITS) & 1;
+        }
+        for (; borrow && i < rn; i++) {
+                ddigit_t d = (ddigit_t) r[i] - borrow;
+                r[i] = (digit_t) d;
+                borrow = (d >> DIGIT_BITS) & 1;
+        }
+}
+
+static void mag_mul_school(digit_t *r, const digit_t *a, uint an,
+                           const digit_t *b, uint bn)
+{
+        memset(r, 0, (an + bn) * sizeof(digit_t));
+        for (uint i = 0; i < an; i++) {
+                ddigit_t ai = a[i];
+                ddigit_t carry = 0;
+                if (!ai) {
+                        continue;
+                }
+                for (uint j = 0; j < bn; j++) {
+                        carry += ai * b[j] + r[i + j];
+                        r[i + j] = (digit_t) carry;
+                        carry >>= DIGIT_BITS;
+                }
+                r[i + bn] = (digit_t) carry;
+        }
+}
+
+/* r = a * b, where r has an + bn digits and does not overlap a or b; the
+ * operands need not be normalized
+ */
+static void mag_mul(digit_t *r, const digit_t *a, uint an,
+                    const digit_t *b, uint bn)
+{
+        if (an < bn) {
+                const digit_t *t = a;
+                uint tn = an;
+                a = b;
+                an = bn;
+                b = t;
+                bn = tn;
+        }
+        if (bn < BIGNUM_KARATSUBA_DIGITS) {
+                mag_mul_school(r, a, an, b, bn);
+                return;
+        }
+        if (2 * bn <= an) {
+                /* unbalanced: multiply b by slices of a of its length */
+                digit_t *t = new_digits(2 * bn);
+                memset(r, 0, (an + bn) * sizeof(digit_t));
+                for (uint i = 0; i < an; i += bn) {
+                        uint n = MIN(bn, an - i);
+                        mag_mul(t, a + i, n, b, bn);
+                        mag_add_into(r + i, an + bn - i, t, n + bn);
+                }
+                xfree(t);
+                return;
+        }
+
+        /* a = a1 * B^m + a0, b = b1 * B^m + b0, with bn > m */
+        uint m = an / 2;
+        uint a1n = an - m;
+        uint b1n = bn - m;
+        uint sn = a1n + 1;
+        uint tn = MAX(m, b1n) + 1;
+        digit_t *s = new_digits(2 * (sn + tn));
+        digit_t *t = s + sn;
+        digit_t *z1 = t + tn;
+
+        /* z0 = a0 * b0 goes to the low part of r, z2 = a1 * b1 to the high */
+        mag_mul(r, a, m, b, m);
+        mag_mul(r + 2 * m, a + m, a1n, b + m, b1n);
+
+        /* z1 = (a0 + a1) * (b0 + b1) - z0 - z2 */
+        memset(s, 0, (sn + tn) * sizeof(digit_t));
+        mag_add_into(s, sn, a, m);
+        mag_add_into(s, sn, a + m, a1n);
+        mag_add_into(t, tn, b, m);
+        mag_add_into(t, tn, b + m, b1n);
+        mag_mul(z1, s, sn, t, tn);
+        mag_sub_into(z1, sn + tn, r, 2 * m);
+        mag_sub_into(z1, sn + tn, r + 2 * m, a1n + b1n);
+        mag_add_into(r + m, an + bn - m, z1, mag_len(z1, sn + tn));
+        xfree(s);
+}
+
+/* r = a << shift, with shift < DIGIT_BITS; return the digit shifted out */
+static digit_t mag_shl(digit_t *r, const digit_t *a, uint n, int shift)
+{
+        digit_t out = 0;
+
+        if (!shift) {
+                memmove(r, a, n * sizeof(digit_t));
+                return 0;
+        }
+        for (uint i = 0; i < n; i++) {
+                digit_t d = a[i];
+                r[i] = (d << shift) | out;
+                out = d >> (DIGIT_BITS - shift);
+        }
+        return out;
+}
+
+/* Divide a by b, normalized, with an >= bn > 0: q gets an - bn + 1 digits,
+ * rem bn digits; either may be 0.
+ */
+static void mag_divmod(digit_t *q, digit_t *rem, const digit_t *a, uint an,
+                       const digit_t *b, uint bn)
+{
+        if (bn == 1) {
+                ddigit_t r = 0;
+                for (uint i = an; i-- > 0; ) {
+                        r = (r << DIGIT_BITS) | a[i];
+                        if (q) {
+                                q[i] = (digit_t) (r / b[0]);
+                        }
+                        r %= b[0];
+                }
+                if (rem) {
+                        rem[0] = (digit_t) r;
+                }
+                return;
+        }
+
+        /* normalize so the top digit of the divisor has its high bit set */
+        int shift = __builtin_clz(b[bn - 1]);
+        digit_t *u = new_digits(an + 1 + bn);
+        digit_t *v = u + an + 1;
+        mag_shl(v, b, bn, shift);
+        u[an] = mag_shl(u, a, an, shift);
+
+        for (uint j = an - bn + 1; j-- > 0; ) {
+                ddigit_t num = ((ddigit_t) u[j + bn] << DIGIT_BITS)
+                        | u[j + bn - 1];
+                ddigit_t qhat = num / v[bn - 1];
+                ddigit_t rhat = num % v[bn - 1];
+
+                while (qhat >> DIGIT_BITS
+                       || qhat * v[bn - 2]
+                          > ((rhat << DIGIT_BITS) | u[j + bn - 2])) {
+                        qhat--;
+                        rhat += v[bn - 1];
+                        if (rhat >> DIGIT_BITS) {
+                                break;
+                        }
+                }
+
+                /* u[j .. j + bn] -= qhat * v */
+                int64_t k = 0;
+                int64_t t;
+                for (uint i = 0; i < bn; i++) {
+                        ddigit_t p = qhat * v[i];
+                        t = (int64_t) u[i + j] - k - (int64_t) (digit_t) p;
+                        u[i + j] = (digit_t) t;
+                        k = (int64_t) (p >> DIGIT_BITS) - (t >> DIGIT_BITS);
+                }
+                t = (int64_t) u[j + bn] - k;
+                u[j + bn] = (digit_t) t;
+
+                if (t < 0) {
+                        /* qhat was one too large; add v back */
+                        qhat--;
+                        ddigit_t carry = 0;
+                        for (uint i = 0; i < bn; i++) {
+                                carry += (ddigit_t) u[i + j] + v[i];
+                                u[i + j] = (digit_t) carry;
+                                carry >>= DIGIT_BITS;
+                        }
+                        u[j + bn] += (digit_t) carry;
+                }
+                if (q) {
+                        q[j] = (digit_t) qhat;
+                }
+        }
+
+        if (rem) {
+                if (shift) {
+                        for (uint i = 0; i < bn - 1; i++) {
+                                rem[i] = (u[i] >> shift)
+                                        | (u[i + 1] << (DIGIT_BITS - shift));
+                        }
+                        rem[bn - 1] = u[bn - 1] >> shift;
+                } else {
+                        memcpy(rem, u, bn * sizeof(digit_t));
+                }
+        }
+        xfree(u);
+}
+
+
+void big_of(bigint_t *b, obp_t ob)
+{
+        if (IS(ob, BIGNUM)) {
+                Lbignum_t *big = AS(ob, BIGNUM);
+                b->digit = big->digit;
+                b->ndigits = big->ndigits;
+                b->negative = big->negative;
+                b->owned = 0;
+        } else {
+                big_from_long(b, INT_VALUE(ob));
+        }
+}
+
+void big_from_long(bigint_t *b, long value)
+{
+        ulong mag = value < 0 ? 0 - (ulong) value : (ulong) value;
+
+        b->digit = new_digits(2);
+        b->digit[0] = (digit_t) mag;
+        b->digit[1] = (digit_t) (mag >> DIGIT_BITS);
+        b->ndigits = mag_len(b->digit, 2);
+        b->negative = value < 0;
+        b->owned = 1;
+}
+
+int big_to_long(bigint_t *b, long *value)
+{
+        if (b->ndigits > 2) {
+                return 0;
+        }
+        ulong mag = 0;
+        for (uint i = b->ndigits; i-- > 0; ) {
+                mag = (mag << DIGIT_BITS) | b->digit[i];
+        }
+        if (!b->negative && mag <= LONG_MAX) {
+                *value = mag;
+                return 1;
+        }
+        if (b->negative && mag - 1 <= LONG_MAX) {
+                *value = -(long) (mag - 1) - 1;
+                return 1;
+        }
+        return 0;
+}
+
+double big_to_double(bigint_t *b)
+{
+        double d = 0;
+        for (uint i = b->ndigits; i-- > 0; ) {
+                d = d * 4294967296.0 + b->digit[i];
+        }
+        return b->negative ? -d : d;
+}
+
+obp_t big_object(bigint_t *b)
+{
+        long value;
+        obp_t ob;
+
+        if (big_to_long(b, &value)) {
+                ob = new_integer(value);
+        } else {
+                ob = new_bignum(b->ndigits, b->negative);
+                memcpy(AS(ob, BIGNUM)->digit, b->digit,
+                       b->ndigits * sizeof(digit_t));
+        }
+        big_free(b);
+        return ob;
+}
+
+void big_free(bigint_t *b)
+{
+        if (b->owned) {
+                xfree(b->digit);
+                b->owned = 0;
+        }
+        b->digit = 0;
+        b->ndigits = 0;
+}
+
+int big_cmp(bigint_t *a, bigint_t *b)
+{
+        if (a->negative != b->negative) {
+                return a->negative ? -1 : 1;
+        }
+        int cmp = mag_cmp(a->digit, a->ndigits, b->digit, b->ndigits);
+        return a->negative ? -cmp : cmp;
+}
+
+void big_add(bigint_t *r, bigint_t *a, bigint_t *b)
+{
+        if (mag_cmp(a->digit, a->ndigits, b->digit, b->ndigits) < 0) {
+                bigint_t *t = a;
+                a = b;
+                b = t;
+        }
+        /* now |a| >= |b|, and the sign of the result is that of a */
+        uint n = a->ndigits + 1;
+        r->digit = new_digits(n);
+        memcpy(r->digit, a->digit, a->ndigits * sizeof(digit_t));
+        r->digit[a->ndigits] = 0;
+        if (a->negative == b->negative) {
+                mag_add_into(r->digit, n, b->digit, b->ndigits);
+        } else {
+                mag_sub_into(r->digit, n, b->digit, b->ndigits);
+        }
+        r->ndigits = mag_len(r->digit, n);
+        r->negative = a->negative && r->ndigits;
+        r->owned = 1;
+}
+
+void big_sub(bigint_t *r, bigint_t *a, bigint_t *b)
+{
+        bigint_t minus_b = *b;
+        minus_b.negative = !b->negative;
+        big_add(r, a, &minus_b);
+}
+
+void big_mul(bigint_t *r, bigint_t *a, bigint_t *b)
+{
+        uint n = a->ndigits + b->ndigits;
+        r->digit = new_digits(n);
+        mag_mul(r->digit, a->digit, a->ndigits, b->digit, b->ndigits);
+        r->ndigits = mag_len(r->digit, n);
+        r->negative = (a->negative != b->negative) && r->ndigits;
+        r->owned = 1;
+}
+
+void big_divmod(bigint_t *q, bigint_t *r, bigint_t *a, bigint_t *b)
+{
+        uint an = a->ndigits;
+        uint bn = b->ndigits;
+        int negative = a->negative != b->negative;
+
+        assert(bn);
+        if (mag_cmp(a->digit, an, b->digit, bn) < 0) {
+                if (q) {
+                        big_from_long(q, 0);
+                }
+                if (r) {
+                        r->digit = new_digits(an);
+                        memcpy(r->digit, a->digit, an * sizeof(digit_t));
+                        r->ndigits = an;
+                        r->negative = a->negative;
+                        r->owned = 1;
+                }
+                return;
+        }
+        if (q) {
+                q->digit = new_digits(an - bn + 1);
+                q->owned = 1;
+        }
+        if (r) {
+                r->digit = new_digits(bn);
+                r->owned = 1;
+        }
+        mag_divmod(q ? q->digit : 0, r ? r->digit : 0,
+                   a->digit, an, b->digit, bn);
+        if (q) {
+                q->ndigits = mag_len(q->digit, an - bn + 1);
+                q->negative = negative && q->ndigits;
+        }
+        if (r) {
+                r->ndigits = mag_len(r->digit, bn);
+                r->negative = a->negative && r->ndigits;
+        }
+}
+
+/* r = a shifted left by n digits */
+static void big_shift_digits(bigint_t *r, bigint_t *a, uint n)
+{
+        r->digit = new_digits(a->ndigits + n);
+        memset(r->digit, 0, n * sizeof(digit_t));
+        memcpy(r->digit + n, a->digit, a->ndigits * sizeof(digit_t));
+        r->ndigits = a->ndigits + n;
+        r->negative = a->negative;
+        r->owned = 1;
+}
+
+double big_quotient(bigint_t *a, bigint_t *b)
+{
+        /* Scale the operands so the integer quotient has more than 64 bits,
+         * which is more than a double can hold, and scale it back after the
+         * conversion, so neither operand needs to fit in a double.
+         */
+        int shift = (int) b->ndigits - (int) a->ndigits + 3;
+        bigint_t sa = *a;
+        bigint_t sb = *b;
+        bigint_t q;
+
+        if (!a->ndigits) {
+                return 0;
+        }
+        if (shift > 0) {
+                big_shift_digits(&sa, a, shift);
+        } else if (shift < 0) {
+                big_shift_digits(&sb, b, -shift);
+        }
+        big_divmod(&q, 0, &sa, &sb);
+        double d = big_to_double(&q);
+        big_free(&q);
+        if (shift > 0) {
+                big_free(&sa);
+        } else if (shift < 0) {
+                big_free(&sb);
+        }
+        return ldexp(d, -shift * DIGIT_BITS);
+}
+
+strbuf_t big_to_decimal(strbuf_t sb, obp_t ob)
+{
+        Lbignum_t *big = AS(ob, BIGNUM);
+        uint n = big->ndigits;
+        digit_t *t = new_digits(n);
+        /* a digit has less than 9.7 decimal digits */
+        digit_t *chunk = new_digits(n + n / 8 + 1);
+        uint nchunks = 0;
+        char buf[DECIMAL_DIGITS + 2];
+
+        memcpy(t, big->digit, n * sizeof(digit_t));
+        while (n) {
+                ddigit_t r = 0;
+                for (uint i = n; i-- > 0; ) {
+                        r = (r << DIGIT_BITS) | t[i];
+                        t[i] = (digit_t) (r / DECIMAL_BASE);
+                        r %= DECIMAL_BASE;
+                }
+                chunk[nchunks++] = (digit_t) r;
+                n = mag_len(t, n);
+        }
+        if (big->negative) {
+                sb = strbuf_addc(sb, '-');
+        }
+        sprintf(buf, "%u", chunk[--nchunks]);
+        sb = strbuf_append(sb, buf);
+        while (nchunks) {
+                sprintf(buf, "%09u", chunk[--nchunks]);
+                sb = strbuf_append(sb, buf);
+        }
+        xfree(chunk);
+        xfree(t);
+        return sb;
+}
+
+obp_t big_read(char *s, uint len)
+{
+        bigint_t b;
+        uint i = 0;
+
+        b.negative = 0;
+        if (len && (s[0] == '-' || s[0] == '+')) {
+                b.negative = s[0] == '-';
+                i++;
+        }
+        b.digit = new_digits(len / DECIMAL_DIGITS + 2);
+        b.ndigits = 0;
+        b.owned = 1;
+
+        /* the first chunk takes the digits left over by the full ones */
+        uint clen = (len - i) % DECIMAL_DIGITS;
+        if (!clen) {
+                clen = DECIMAL_DIGITS;
+        }
+        while (i < len) {
+                ddigit_t carry = 0;
+                digit_t scale = 1;
+                for (uint end = i + clen; i < end; i++) {
+                        carry = carry * 10 + (s[i] - '0');
+                        scale *= 10;
+                }
+                for (uint j = 0; j < b.ndigits; j++) {
+                        carry += (ddigit_t) b.digit[j] * scale;
+                        b.digit[j] = (digit_t) carry;
+                        carry >>= DIGIT_BITS;
+                }
+                if (carry) {
+                        b.digit[b.ndigits++] = (digit_t) carry;
+                }
+                clen = DECIMAL_DIGITS;
+        }
+        b.negative = b.negative && b.ndigits;
+        return big_object(&b);
+}
+
+/* EOF */
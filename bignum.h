@@ -0,0 +1,100 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * Arbitrary-precision integers
+ */
+
+#ifndef __BIGNUM_H_INC
+#define __BIGNUM_H_INC
+
+#include "cbasics.h"
+#include <stdint.h>
+#include "objects.h"
+#include "strbuf.h"
+
+/* An integer being computed, outside the heap: a sign and a magnitude of
+ * 32-bit digits, least significant first, without leading zero digits, so
+ * zero has no digits. The digits are owned (allocated with xmalloc()) or
+ * borrowed from a BIGNUM object, which must not be collected while they are
+ * in use; as no objects are allocated during the arithmetic, it suffices
+ * that the object is protected.
+ */
+typedef struct BIGINT {
+        uint32_t *digit;
+        uint ndigits;
+        uint negative:1;
+        uint owned:1;                   /* digits must be freed */
+} bigint_t;
+
+/**
+ * Set b to the value of an integer object, borrowing the digits of a bignum.
+ */
+void big_of(bigint_t *b, obp_t ob);
+
+/**
+ * Set b to the value of a long.
+ */
+void big_from_long(bigint_t *b, long value);
+
+/**
+ * Store the value of b into *value and return non-zero iff it fits in a long.
+ */
+int big_to_long(bigint_t *b, long *value);
+
+/**
+ * Return the value of b as a double, which may be infinite.
+ */
+double big_to_double(bigint_t *b);
+
+/**
+ * Make an integer object of the value of b, a fixnum or plain integer if it
+ * fits, and free b.
+ */
+obp_t big_object(bigint_t *b);
+
+/**
+ * Free the digits of b if it owns them.
+ */
+void big_free(bigint_t *b);
+
+/**
+ * Return a negative number, zero, or a positive number as a is less than,
+ * equal to, or greater than b.
+ */
+int big_cmp(bigint_t *a, bigint_t *b);
+
+/**
+ * r = a + b, r = a - b, r = a * b. The result is owned and must not be one of
+ * the operands.
+ */
+void big_add(bigint_t *r, bigint_t *a, bigint_t *b);
+void big_sub(bigint_t *r, bigint_t *a, bigint_t *b);
+void big_mul(bigint_t *r, bigint_t *a, bigint_t *b);
+
+/**
+ * Divide a by b, which must not be zero, truncating towards zero: q is the
+ * quotient, r the remainder with the sign of a. Either of q and r may be 0 if
+ * it is not needed.
+ */
+void big_divmod(bigint_t *q, bigint_t *r, bigint_t *a, bigint_t *b);
+
+/**
+ * Return a / b, with b not zero, as a double, which is infinite or zero only
+ * if the quotient is out of the range of a double.
+ */
+double big_quotient(bigint_t *a, bigint_t *b);
+
+/**
+ * Append the decimal representation of a bignum object to the strbuf.
+ */
+strbuf_t big_to_decimal(strbuf_t sb, obp_t ob);
+
+/**
+ * Make an integer object from a string of decimal digits with an optional
+ * sign.
+ */
+obp_t big_read(char *s, uint len);
+
+
+#endif  /* __BIGNUM_H_INC */
@@ -15,6 +15,7 @@
 #include "reader.h"
 #include "printer.h"
 #include "gc.h"
+#include "bytecode.h"
 
 
 /*
@@ -44,14 +45,12 @@ uint list_length(obp_t list)
 }
 
 /**
- * Call a builtin function and return the value (or error). The function object
- * fun must be of type F_BUILTIN. Check the number of arguments against the
- * range specified with register_builtin().
+ * Return an error unless the number of arguments is in the range specified
+ * with register_builtin(); return 0 if it is.
  */
-obp_t call_builtin(obp_t fun, obp_t args, session_context_t *sc, int level)
+static obp_t check_nargs(obp_t fun, int nargs, session_context_t *sc)
 {
         Lfunction_t *bi = AS(fun, FUNCTION);
-        int nargs = list_length(args);
 
         if (nargs < bi->minargs ||
             (bi->maxargs >= 0 && nargs > bi->maxargs))
@@ -60,7 +59,58 @@ obp_t call_builtin(obp_t fun, obp_t args, session_context_t *sc, int level)
                                    "invalid number of arguments, %d not in [%d..%d]",
                                    nargs, bi->minargs, bi->maxargs);
         }
-        return bi->impl.builtin(nargs, args, sc, level);
+        return 0;
+}
+
+/**
+ * Call a builtin function and return the value (or error). The function object
+ * fun must be of type F_BUILTIN. Check the number of arguments against the
+ * range specified with register_builtin(). A builtin taking an argument vector
+ * gets the arguments copied onto the value stack.
+ */
+obp_t call_builtin(obp_t fun, obp_t args, session_context_t *sc, int level)
+{
+        Lfunction_t *bi = AS(fun, FUNCTION);
+        int nargs = list_length(args);
+        obp_t error = check_nargs(fun, nargs, sc);
+
+        if (error) {
+                return error;
+        }
+        if (!bi->argv) {
+                return bi->impl.builtin(nargs, args, sc, level);
+        }
+        uint base = reserve_values(nargs);
+        for (int i = 0; i < nargs; i++) {
+                value_stack[base + i] = CAR(args);
+                args = CDR(args);
+        }
+        obp_t retval = bi->impl.builtin_argv(nargs, value_stack + base, sc,
+                                             level);
+        value_stack_top = base;
+        return retval;
+}
+
+obp_t call_builtin_argv(obp_t fun, int argc, obp_t *argv,
+                        session_context_t *sc, int level)
+{
+        Lfunction_t *bi = AS(fun, FUNCTION);
+        obp_t error = check_nargs(fun, argc, sc);
+
+        if (error) {
+                return error;
+        }
+        if (bi->argv) {
+                return bi->impl.builtin_argv(argc, argv, sc, level);
+        }
+        PROTECT;
+        PROTVAR(args);
+        for (int i = argc - 1; i >= 0; i--) {
+                args = new_pair(argv[i], args);
+        }
+        obp_t retval = bi->impl.builtin(argc, args, sc, level);
+        UNPROTECT;
+        return retval;
 }
 
 /**
@@ -72,7 +122,7 @@ obp_t bf_length(int nargs, obp_t args, session_context_t *sc, int level)
 {
         obp_t ob = CAR(args);
         long value;
-        switch (ob->type) {
+        switch (type_of(ob)) {
             case PAIR:
                 value = list_length(ob);
                 break;
@@ -94,7 +144,7 @@ obp_t bf_length(int nargs, obp_t args, session_context_t *sc, int level)
             default:
                 return throw_error(sc->out, ERR_INVARG, ob,
                                    "sorry, I cannot come up with any reasonable meaning of \"length\" for objects of type %s",
-                                   type_name(ob->type));
+                                   type_name(type_of(ob)));
         }
         return new_integer(value);
 }
@@ -123,6 +173,7 @@ obp_t bf_setq(int nargs, obp_t args, session_context_t *sc, int level)
                 retval = eval(CAR(args), sc, level);
                 CHECK_ERROR(retval);
                 AS(symbol, SYMBOL)->value = retval;
+                gc_write_barrier(symbol, retval);
                 args = CDR(args);
         }
     EXIT:
@@ -172,9 +223,9 @@ obp_t bf_if(int nargs, obp_t args, session_context_t *sc, int level)
  * Return the car of a pair or, of nil, nil.
  * (car arg)
  */
-obp_t bf_car(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_car(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg = CAR(args);
+        obp_t arg = argv[0];
         if (IS(arg, PAIR)) {
                 return CAR(arg);
         } else if (IS_NIL(arg)) {
@@ -188,9 +239,9 @@ obp_t bf_car(int nargs, obp_t args, session_context_t *sc, int level)
  * Return the cdr of a pair or, of nil, nil.
  * (cdr arg)
  */
-obp_t bf_cdr(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_cdr(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg = CAR(args);
+        obp_t arg = argv[0];
         if (IS(arg, PAIR)) {
                 return CDR(arg);
         } else if (IS_NIL(arg)) {
@@ -203,10 +254,10 @@ obp_t bf_cdr(int nargs, obp_t args, session_context_t *sc, int level)
 /**
  * (cons carval cdrval)
  */
-obp_t bf_cons(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_cons(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg1 = CAR(args);
-        obp_t arg2 = CADR(args);
+        obp_t arg1 = argv[0];
+        obp_t arg2 = argv[1];
         return new_pair(arg1, arg2);
 }
 
@@ -297,13 +348,17 @@ obp_t bf_fset(int nargs, obp_t args, session_context_t *sc, int level)
         obp_t sym = CAR(args);
         obp_t form = CADR(args);
 
+        CHECKTYPE(sc->out, sym, SYMBOL);
         if (sym->immutable) {
                 ERROR(sc->out, ERR_IMMUTBL, sym,
                       "symbol's function cell may not be modified");
         }
         func = make_function(THE_STRINGS(AS(sym, SYMBOL)->name), form, sc);
         CHECK_ERROR(func);
-        AS(sym, SYMBOL)->function = func;
+        if (compile_on_defun && IS_FORM(func)) {
+                compile_function(func);
+        }
+        set_function(sym, func);
         retval = func;
     EXIT:
         UNPROTECT;
@@ -311,9 +366,10 @@ obp_t bf_fset(int nargs, obp_t args, session_context_t *sc, int level)
 }
 
 /**
- * Common part of function and special form definitions.
+ * Common part of function, special form, and macro definitions.
  */
-obp_t def_common(obp_t args, session_context_t *sc, obp_t marker)
+obp_t def_common(obp_t args, session_context_t *sc, obp_t marker,
+                 int is_macro)
 {
         PROTECT;
         PROTVAR(form);
@@ -324,7 +380,14 @@ obp_t def_common(obp_t args, session_context_t *sc, obp_t marker)
         form = new_pair(marker, CDR(args));
         func = make_function(THE_STRINGS(AS(sym, SYMBOL)->name), form, sc);
         CHECK_ERROR(func);
-        AS(sym, SYMBOL)->function = func;
+        if (is_macro) {
+                AS(func, FUNCTION)->is_special = 1;
+                AS(func, FUNCTION)->is_macro = 1;
+        }
+        if (compile_on_defun) {
+                compile_function(func);
+        }
+        set_function(sym, func);
         retval = sym;
     EXIT:
         UNPROTECT;
@@ -337,7 +400,7 @@ obp_t def_common(obp_t args, session_context_t *sc, obp_t marker)
  */
 obp_t bf_defun(int nargs, obp_t args, session_context_t *sc, int level)
 {
-        return def_common(args, sc, the_Lambda);
+        return def_common(args, sc, the_Lambda, 0);
 }
 
 /**
@@ -346,16 +409,63 @@ obp_t bf_defun(int nargs, obp_t args, session_context_t *sc, int level)
  */
 obp_t bf_defspecial(int nargs, obp_t args, session_context_t *sc, int level)
 {
-        return def_common(args, sc, the_Mu);
+        return def_common(args, sc, the_Mu, 0);
+}
+
+/**
+ * Define a macro. It is called with the arguments unevaluated, like a special
+ * form, and returns the form to be evaluated in place of the call. The
+ * expansion is made once and cached for the calling form, see eval_macro().
+ * (defmacro name args [bodyform ...])
+ */
+obp_t bf_defmacro(int nargs, obp_t args, session_context_t *sc, int level)
+{
+        return def_common(args, sc, the_Lambda, 1);
+}
+
+/**
+ * If the argument is a call of a macro, return its expansion, otherwise the
+ * argument itself.
+ * (macroexpand-1 form)
+ */
+obp_t bf_macroexpand_1(int nargs, obp_t args, session_context_t *sc, int level)
+{
+        obp_t form = CAR(args);
+        obp_t macro = macro_of(form);
+
+        if (!macro) {
+                return form;
+        }
+        return expand_macro(form, macro, sc, level);
+}
+
+/**
+ * Expand the argument as long as it is a call of a macro and return the
+ * result.
+ * (macroexpand form)
+ */
+obp_t bf_macroexpand(int nargs, obp_t args, session_context_t *sc, int level)
+{
+        PROTECT;
+        PROTVAL(retval, CAR(args));
+        obp_t macro;
+
+        while ((macro = macro_of(retval))) {
+                retval = expand_macro(retval, macro, sc, level);
+                CHECK_ERROR(retval);
+        }
+    EXIT:
+        UNPROTECT;
+        return retval;
 }
 
 /**
  * Return t if the two arguments are the same object, nil otherwise.
  * (eq arg1 arg2)
  */
-obp_t bf_eq(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_eq(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        return CAR(args) == CADR(args) ? the_T : the_Nil;
+        return argv[0] == argv[1] ? the_T : the_Nil;
 }
 
 /**
@@ -363,17 +473,16 @@ obp_t bf_eq(int nargs, obp_t args, session_context_t *sc, int level)
  * equal!) value.
  * (eql arg1 arg2)
  */
-obp_t bf_eql(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_eql(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg1 = CAR(args);
-        obp_t arg2 = CADR(args);
+        obp_t arg1 = argv[0];
+        obp_t arg2 = argv[1];
 
         if (arg1 == arg2) {
                 return the_T;
-        } else if (arg1->size == arg2->size
-                   && !memcmp(&arg1->size,
-                              &arg2->size,
-                              arg1->size - offsetof(Lobject_t, size))) {
+        } else if (IS_IMMEDIATE(arg1) || IS_IMMEDIATE(arg2)) {
+                return the_Nil;
+        } else if (contents_equal(arg1, arg2)) {
                 return the_T;
         } else {
                 return the_Nil;
@@ -384,9 +493,9 @@ obp_t bf_eql(int nargs, obp_t args, session_context_t *sc, int level)
  * Return t iff the argument is nil.
  * (null arg)
  */
-obp_t bf_null(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_null(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg = CAR(args);
+        obp_t arg = argv[0];
         return (arg == the_Nil ? the_T : the_Nil);
 }
 
@@ -426,9 +535,9 @@ obp_t bf_tty(int nargs, obp_t args, session_context_t *sc, int level)
  * Return T if the argument is not a pair, Nil otherwise.
  * (atom arg)
  */
-obp_t bf_atom(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_atom(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg = CAR(args);
+        obp_t arg = argv[0];
         return IS(arg, PAIR) ? the_Nil : the_T;
 }
 
@@ -442,7 +551,7 @@ obp_t bf_atom(int nargs, obp_t args, session_context_t *sc, int level)
 obp_t bf_function(int nargs, obp_t args, session_context_t *sc, int level)
 {
         obp_t arg = CAR(args);
-        switch (arg->type) {
+        switch (type_of(arg)) {
             case SYMBOL:
                 return AS(arg, SYMBOL)->function;
             case PAIR: 
@@ -454,12 +563,26 @@ obp_t bf_function(int nargs, obp_t args, session_context_t *sc, int level)
         }
 }
 
+/**
+ * Special form: declarations about a function, like (lexical) to analyze its
+ * body with lexical variables (see analyze.c), as the first form of the body.
+ * Return nil.
+ * (declare [declaration ...])
+ */
+obp_t bf_declare(int nargs, obp_t args, session_context_t *sc, int level)
+{
+        return the_Nil;
+}
+
+builtin_func_t bf_progn;
+
 /**
  * The cond special form: for each argument, which is a list of an antecedent
  * and one or more succeedents, evaluate the antecedent; if it is true
  * (non-nil), the value of the succeedents (with an implicit progn) if the value
- * of the cond form, and no other argument is evaluated. If none if the
- * antecedents is true, the value of the cond form is nil.
+ * of the cond form, and no other argument is evaluated; without succeedents,
+ * the value is that of the antecedent. If none if the antecedents is true, the
+ * value of the cond form is nil.
  * (cond (ante succ) ...)
  */
 obp_t bf_cond(int nargs, obp_t args, session_context_t *sc, int level)
@@ -474,9 +597,14 @@ obp_t bf_cond(int nargs, obp_t args, session_context_t *sc, int level)
                 antecedent = eval(CAR(clause), sc, level);
                 CHECK_ERROR(antecedent);
                 if (!IS_NIL(antecedent)) {
-                        retval = eval(CDR(clause), sc, level);
+                        if (IS_NIL(CDR(clause))) {
+                                retval = antecedent;
+                        } else {
+                                retval = bf_progn(0, CDR(clause), sc, level);
+                        }
                         goto EXIT;
                 }
+                args = CDR(args);
         }
         retval = the_Nil;
     EXIT:
@@ -567,15 +695,15 @@ obp_t bf_measure(int nargs, obp_t args, session_context_t *sc, int level)
                 bindings = new_integer(bind_count - start_bindings);
                 objects = new_integer(object_count - start_objects);
         }
-        temp = cons(intern_z(OBJECTS_NAME), objects);
+        temp = cons(the_Objects, objects);
         retval = cons(temp, the_Nil);
-        temp = cons(intern_z(BINDINGS_NAME), bindings);
+        temp = cons(the_Bindings, bindings);
         retval = cons(temp, retval);
-        temp = cons(intern_z(APPLYS_NAME), applys);
+        temp = cons(the_Applys, applys);
         retval = cons(temp, retval);
-        temp = cons(intern_z(EVALS_NAME), evals);
+        temp = cons(the_Evals, evals);
         retval = cons(temp, retval);
-        temp = cons(intern_z(USECS_NAME), usecs);
+        temp = cons(the_Usecs, usecs);
         retval = cons(temp, retval);
         retval = cons(value, retval);
     EXIT:
@@ -665,9 +793,10 @@ obp_t bf_let(int nargs, obp_t args, session_context_t *sc, int level)
         PROTVAR(retval);
         PROTVAR(symbols);
         PROTVAR(values);
-        PROTVAR(nbindings);
+        PROTVAR(bound);
         PROTVAR(sym);
         PROTVAR(value);
+        uint depth = specpdl_top;
         
         while (IS(bindings, PAIR)) {
                 obp_t binding = CAR(bindings);  /* (sym value) */
@@ -699,8 +828,8 @@ obp_t bf_let(int nargs, obp_t args, session_context_t *sc, int level)
                 ERROR(sc->out, ERR_LETARGS, CAR(args),
                       "bindings not a proper list");
         }
-        nbindings = make_bindings(symbols, values, sc, level);
-        CHECK_ERROR(nbindings);
+        bound = make_bindings(symbols, values, sc, level);
+        CHECK_ERROR(bound);
 
         while (IS(body, PAIR)) {
                 retval = eval(CAR(body), sc, level);
@@ -708,7 +837,7 @@ obp_t bf_let(int nargs, obp_t args, session_context_t *sc, int level)
                 body = CDR(body);
         }
     EXIT:
-        restore_bindings(symbols, AS(nbindings, NUMBER)->value, sc, level);
+        restore_bindings(depth, sc, level);
         UNPROTECT;
         return retval;
 }
@@ -729,10 +858,9 @@ obp_t bf_letrec(int nargs, obp_t args, session_context_t *sc, int level)
 {
         PROTECT;
         obp_t bindings = CAR(args);
-        int nbindings = 0;
+        uint depth = specpdl_top;
         obp_t body = CDR(args);
         PROTVAR(retval);
-        PROTVAR(symbols);
         PROTVAR(sym);
         PROTVAR(newvalue);
 
@@ -759,11 +887,7 @@ obp_t bf_letrec(int nargs, obp_t args, session_context_t *sc, int level)
                         ERROR(sc->out, ERR_LETARGS, binding,
                               "not symbol or list");
                 }
-                Lsymbol_t *symbol = AS(sym, SYMBOL);
-                pushdown(symbol->value);
-                symbols = cons(sym, symbols);
-                nbindings++;
-                symbol->value = newvalue;
+                specbind(sym, newvalue);
                 bindings = CDR(bindings);
         }
 
@@ -774,7 +898,7 @@ obp_t bf_letrec(int nargs, obp_t args, session_context_t *sc, int level)
         }
 
     EXIT:
-        restore_bindings(symbols, nbindings, sc, level);
+        restore_bindings(depth, sc, level);
         UNPROTECT;
         return retval;
 }
@@ -807,6 +931,7 @@ obp_t bf_and(int nargs, obp_t args, session_context_t *sc, int level)
                 if (IS_NIL(retval)) {
                         break;
                 }
+                args = CDR(args);
         }
     EXIT:
         UNPROTECT;
@@ -830,6 +955,7 @@ obp_t bf_or(int nargs, obp_t args, session_context_t *sc, int level)
                 if (!IS_NIL(retval)) {
                         break;
                 }
+                args = CDR(args);
         }
     EXIT:
         UNPROTECT;
@@ -925,9 +1051,11 @@ obp_t bf_while(int nargs, obp_t args, session_context_t *sc, int level)
                 }
                 obp_t forms = body;
                 while (!IS_NIL(forms)) {
-                        CHECK_ERROR(eval(CAR(forms), sc, level));
+                        retval = eval(CAR(forms), sc, level);
+                        CHECK_ERROR(retval);
                         forms = CDR(forms);
                 }
+                retval = the_Nil;
         } while (1);
     EXIT:
         UNPROTECT;
@@ -1069,7 +1197,7 @@ obp_t bf_autoload(int nargs, obp_t args, session_context_t *sc, int level)
         
         PROTVAL(func, new_autoload_function(THE_STRINGS(AS(sym, SYMBOL)->name),
                                           filename, is_special != the_Nil));
-        AS(sym, SYMBOL)->function = func;
+        set_function(sym, func);
         retval = func;
     EXIT:
         UNPROTECT;
@@ -1099,15 +1227,57 @@ obp_t bf_describe(int nargs, obp_t args, session_context_t *sc, int level)
 }
 
 /**
- * Invoke the garbage collector.
+ * Invoke the garbage collector for a major collection.
  * (gc)
  */
 obp_t bf_gc(int nargs, obp_t args, session_context_t *sc, int level)
 {
-        gc();
+        gc_full();
         return the_Nil;
 }
 
+/**
+ * Get or set the heap growth factor of the garbage collector: a collection is
+ * due when the bytes allocated since the last one reach (factor - 1) times the
+ * bytes that survived it. If the argument is present, it must be a number
+ * greater than 1 and becomes the new factor. Return the factor.
+ * (gc-growth [factor])
+ */
+obp_t bf_gc_growth(int nargs, obp_t args, session_context_t *sc, int level)
+{
+        if (nargs == 1) {
+                obp_t arg = CAR(args);
+                CHECKTYPE_RET(sc->out, arg, NUMBER);
+                if (!(DOUBLE_VALUE(arg) > 1)) {
+                        return throw_error(sc->out, ERR_INVARG, arg,
+                                           "growth factor must be above 1");
+                }
+                gc_growth = DOUBLE_VALUE(arg);
+        }
+        return new_double(gc_growth);
+}
+
+/**
+ * Get or set the maximum nesting depth of function calls; a deeper call is an
+ * error. If the argument is present, it must be a positive integer and becomes
+ * the new maximum. Return the maximum.
+ * (max-depth [depth])
+ */
+obp_t bf_max_depth(int nargs, obp_t args, session_context_t *sc, int level)
+{
+        if (nargs == 1) {
+                obp_t arg = CAR(args);
+                CHECKTYPE_RET(sc->out, arg, NUMBER);
+                if (!IS_INT(arg) || DOUBLE_VALUE(arg) < 1
+                    || DOUBLE_VALUE(arg) > UINT_MAX) {
+                        return throw_error(sc->out, ERR_INVARG, arg,
+                                           "depth must be a positive integer");
+                }
+                max_depth = DOUBLE_VALUE(arg);
+        }
+        return new_integer(max_depth);
+}
+
 /**
  * Get or set the trace bit on a function. With one argument, return t if the
  * trace flag is set, nil otherwise. If the second argument is present, set the
@@ -1122,6 +1292,7 @@ obp_t bf_trace_function(int nargs, obp_t args, session_context_t *sc, int level)
 
         if (nargs == 2) {
                 func->trace = CADR(args) == the_Nil ? 0 : 1;
+                function_epoch++;       /* see analyze.c */
         }
         return func->trace ? the_T : the_Nil;
 }
@@ -1162,6 +1333,7 @@ Lfunction_t *new_function_common(char *name, uint namelen, int is_special,
         ob->is_special = !!is_special;
         ob->minargs = minargs;
         ob->maxargs = maxargs;
+        ob->code = the_Nil;
 
         return ob;
 }
@@ -1214,10 +1386,22 @@ obp_t register_builtin(char *name, builtin_func_t builtin,
         PROTECT;
         PROTVAL(bi, new_builtin_function(name, strlen(name), builtin,
                                          is_special, minargs, maxargs));
-        Lsymbol_t *sym = AS(intern_z(name), SYMBOL);
-        //describe((obp_t) sym);
-        sym->function = bi;
-        //describe((obp_t) sym);
+        set_function(intern_z(name), bi);
+        UNPROTECT;
+        return bi;
+}
+
+obp_t register_builtin_argv(char *name, builtin_argv_t builtin,
+                            short minargs, short maxargs)
+{
+        PROTECT;
+        Lfunction_t *func = new_function_common(name, strlen(name), 0,
+                                                minargs, maxargs);
+        PROTVAL(bi, (obp_t) func);
+        func->impl.builtin_argv = builtin;
+        func->argv = 1;
+        func->type = F_BUILTIN;
+        set_function(intern_z(name), bi);
         UNPROTECT;
         return bi;
 }
@@ -1231,9 +1415,9 @@ void init_builtins(void)
         register_builtin(LAMBDA_NAME, bf_lambda, 1, 1, -1);
         register_builtin(FSET_NAME, bf_fset, 0, 2, 2);
         register_builtin(IF_NAME, bf_if, 1, 0, -1);
-        register_builtin(CAR_NAME, bf_car, 0, 1, 1);
-        register_builtin(CDR_NAME, bf_cdr, 0, 1, 1);
-        register_builtin(CONS_NAME, bf_cons, 0, 2, 2);
+        register_builtin_argv(CAR_NAME, bf_car, 1, 1);
+        register_builtin_argv(CDR_NAME, bf_cdr, 1, 1);
+        register_builtin_argv(CONS_NAME, bf_cons, 2, 2);
         register_builtin(EVAL_NAME, bf_eval, 0, 1, 1);
         register_builtin(QUOTE_NAME, bf_quote, 1, 1, 1);
         register_builtin(LOAD_NAME, bf_load, 0, 0, -1);
@@ -1242,12 +1426,16 @@ void init_builtins(void)
         register_builtin(SYMBOLS_NAME, bf_symbols, 0, 0, 0);
         register_builtin(FSET_NAME, bf_fset, 0, 2, 2);
         register_builtin(DEFUN_NAME, bf_defun, 1, 2, -1);
-        register_builtin(EQ_NAME, bf_eq, 0, 2, 2);
-        register_builtin(NULL_NAME, bf_null, 0, 1, 1);
+        register_builtin(DEFMACRO_NAME, bf_defmacro, 1, 2, -1);
+        register_builtin(MACROEXPAND_NAME, bf_macroexpand, 0, 1, 1);
+        register_builtin(MACROEXPAND_1_NAME, bf_macroexpand_1, 0, 1, 1);
+        register_builtin_argv(EQ_NAME, bf_eq, 2, 2);
+        register_builtin_argv(NULL_NAME, bf_null, 1, 1);
         register_builtin(TRACE_NAME, bf_trace, 0, 0, 1);
         register_builtin(TTY_NAME, bf_tty, 0, 0, 1);
-        register_builtin(ATOM_NAME, bf_atom, 0, 1, 1);
+        register_builtin_argv(ATOM_NAME, bf_atom, 1, 1);
         register_builtin(FUNCTION_NAME, bf_function, 1, 1, 1);
+        register_builtin(DECLARE_NAME, bf_declare, 1, 0, -1);
         register_builtin(COND_NAME, bf_cond, 1, 0, -1);
         register_builtin(TIME_NAME, bf_time, 1, 0, -1);
         register_builtin(FUNCALL_NAME, bf_funcall, 0, 1, -1);
@@ -1258,12 +1446,12 @@ void init_builtins(void)
         register_builtin(LETREC_NAME, bf_letrec, 1, 1, -1);
         register_builtin(AND_NAME, bf_and, 1, 0, -1);
         register_builtin(OR_NAME, bf_or, 1, 0, -1);
-        register_builtin(NOT_NAME, bf_null, 0, 1, 1);
+        register_builtin_argv(NOT_NAME, bf_null, 1, 1);
         register_builtin(PROGN_NAME, bf_progn, 1, 0, -1);
         register_builtin(WHILE_NAME, bf_while, 1, 1, -1);
         register_builtin(UNWIND_PROTECT_NAME, bf_unwind_protect, 1, 1, -1);
         register_builtin(ERRSET_NAME, bf_errset, 1, 0, -1);
-        register_builtin(EQL_NAME, bf_eql, 0, 2, 2);
+        register_builtin_argv(EQL_NAME, bf_eql, 2, 2);
         register_builtin(PROG1_NAME, bf_prog1, 1, 1, -1);
         register_builtin(PROG2_NAME, bf_prog2, 1, 2, -1);
         register_builtin(PRIN1S_NAME, bf_prin1s, 0, 1, 1);
@@ -1275,6 +1463,8 @@ void init_builtins(void)
         register_builtin(LENGTH_NAME, bf_length, 0, 1, 1);
         register_builtin(APROPOS_NAME, bf_apropos, 0, 1, 1);
         register_builtin(GC_NAME, bf_gc, 0, 0, 0);
+        register_builtin(GC_GROWTH_NAME, bf_gc_growth, 0, 0, 1);
+        register_builtin(MAX_DEPTH_NAME, bf_max_depth, 0, 0, 1);
         register_builtin(TRACE_FUNCTION_NAME, bf_trace_function, 0, 1, 2);
         register_builtin(SHOW_FREELIST_NAME, bf_show_freelist, 0, 0, 0);
         
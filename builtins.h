@@ -14,9 +14,29 @@
 typedef obp_t builtin_func_t(int nargs, obp_t args,
                              session_context_t *sc, int level);
 
+/* A builtin that gets its arguments in a vector instead of a list. The
+ * vector is on the value stack (see eval.h), where it stays valid only as long
+ * as no Lisp code is evaluated, so these builtins must not evaluate anything.
+ */
+typedef obp_t builtin_argv_t(int argc, obp_t *argv,
+                             session_context_t *sc, int level);
+
 obp_t register_builtin(char *name, builtin_func_t builtin,
                        int is_special, short minargs, short maxargs);
+
+/**
+ * Register a builtin taking an argument vector; it cannot be a special form.
+ */
+obp_t register_builtin_argv(char *name, builtin_argv_t builtin,
+                            short minargs, short maxargs);
 obp_t call_builtin(obp_t fun, obp_t args, session_context_t *sc, int level);
+
+/**
+ * Call a builtin function of either kind with the arguments in a vector,
+ * checking their number.
+ */
+obp_t call_builtin_argv(obp_t fun, int argc, obp_t *argv,
+                        session_context_t *sc, int level);
 void init_builtins(void);
 
 #endif  /* __BUILTINS_H_INC */
@@ -0,0 +1,1132 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * The bytecode compiler and virtual machine. The body of a lambda or mu
+ * function can be compiled to a compact stack bytecode, with (compile 'f) or,
+ * if so requested on startup, when the function is defined. The function keeps
+ * its form, from which apply() binds the parameters as before, and vm_run()
+ * runs the body.
+ *
+ * The code vector of a compiled function has the bytecode string as its first
+ * element and the constants used by the code as the others. Instruction
+ * operands are 16-bit numbers, little-endian; the bytecode string starts with
+ * one, the depth of the value stack the function needs.
+ *
+ * A call of a bytecode function from another one does not recurse into
+ * vm_run(); the caller's state is saved in a frame on the VM frame stack, and
+ * the callee runs in the same loop, so the depth of recursion in compiled code
+ * is limited only by max_depth and not by the C stack. A call of a lambda or
+ * bytecode function that is followed only by the return of its value replaces
+ * the current frame; in the outermost one, it is left to apply(), like the
+ * calls in tail position of interpreted function bodies.
+ *
+ * The special forms quote, if, cond, while, let, let*, setq, progn, and, and
+ * or, and some builtins with their usual number of arguments are compiled to
+ * dedicated instructions, as long as their symbols have the builtin function
+ * at compile time. Other function calls go through funcall_values(). Forms using
+ * other special forms, and malformed ones, are left to eval(), so they behave
+ * (and fail) just like when interpreted. A call to a symbol without a builtin
+ * function at compile time is preceded by a check, so that if the symbol has
+ * become a macro, mu function, or other special form by the time the call is
+ * run, the form is left to eval() before any argument is evaluated.
+ */
+
+#include "cbasics.h"
+#include <string.h>
+#include "objects.h"
+#include "bytecode.h"
+#include "builtins.h"
+#include "eval.h"
+#include "names.h"
+#include "numbers.h"
+#include "signals.h"
+#include "xmemory.h"
+#include "gc.h"
+
+typedef enum {
+        OP_CONST,                       /* push a constant */
+        OP_VARREF,                      /* push the value of a symbol */
+        OP_VARSET,                      /* set a symbol to the top value */
+        OP_POP,
+        OP_JUMP,                        /* jump to an offset in the code */
+        OP_JUMPNIL,                     /* pop, and jump if nil */
+        OP_JUMPNILKEEP,                 /* jump if the top is nil, else pop */
+        OP_JUMPNOTNILKEEP,              /* jump if the top is not nil, else
+                                           pop */
+        OP_BIND,                        /* pop and bind a symbol to it */
+        OP_UNBIND,                      /* undo a number of bindings */
+        OP_CALL,                        /* call a symbol's function; the number
+                                           of arguments is in the next byte */
+        OP_EVAL,                        /* push the value of a form */
+        OP_IFSPECIAL,                   /* if the function of the head of a
+                                           form is special, push the value
+                                           of the form and jump */
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_ADD1,
+        OP_SUB1,
+        OP_NUMEQ,
+        OP_LT,
+        OP_GT,
+        OP_LE,
+        OP_GE,
+        OP_CAR,
+        OP_CDR,
+        OP_CONS,
+        OP_EQ,
+        OP_NULL,
+        OP_RETURN,                      /* return the top value */
+        OP_COUNT
+} opcode_t;
+
+vm_frame_t *vm_frames;
+uint vm_frames_top;                     /* index of the next free frame */
+static uint vm_frames_size;             /* number of allocated frames */
+
+/* the operand at a code position */
+#define OPERAND(pc) ((pc)[0] | (pc)[1] << 8)
+
+builtin_func_t bf_quote, bf_if, bf_cond, bf_while, bf_let, bf_letrec,
+        bf_setq, bf_progn, bf_and, bf_or;
+builtin_argv_t bf_plus, bf_minus, bf_times, bf_successor, bf_predecessor,
+        bf_equals, bf_less, bf_greater, bf_lesse, bf_greatere,
+        bf_car, bf_cdr, bf_cons, bf_eq, bf_null;
+
+/* builtins compiled to a single instruction when called with nargs arguments */
+static struct {
+        builtin_argv_t *builtin;
+        int nargs;
+        opcode_t op;
+} builtin_ops[] = {
+        { bf_plus, 2, OP_ADD },
+        { bf_minus, 2, OP_SUB },
+        { bf_times, 2, OP_MUL },
+        { bf_successor, 1, OP_ADD1 },
+        { bf_predecessor, 1, OP_SUB1 },
+        { bf_equals, 2, OP_NUMEQ },
+        { bf_less, 2, OP_LT },
+        { bf_greater, 2, OP_GT },
+        { bf_lesse, 2, OP_LE },
+        { bf_greatere, 2, OP_GE },
+        { bf_car, 1, OP_CAR },
+        { bf_cdr, 1, OP_CDR },
+        { bf_cons, 2, OP_CONS },
+        { bf_eq, 2, OP_EQ },
+        { bf_null, 1, OP_NULL },
+        { 0, 0, 0 }
+};
+
+int compile_on_defun;                   /* compile functions when defined */
+
+
+
+/* The compiler state. The constants need no protection from the GC, as they
+ * are all part of the form being compiled.
+ */
+typedef struct COMPILER {
+        uchar *code;                    /* the bytecode */
+        uint length;                    /* length of the bytecode */
+        uint size;                      /* allocated size of the bytecode */
+        obp_t *consts;                  /* the constants */
+        uint nconsts;                   /* number of constants */
+        uint consts_size;               /* allocated number of constants */
+        int depth;                      /* current depth of the value stack */
+        int maxdepth;                   /* maximum depth of the value stack */
+        int too_large;                  /* an operand does not fit */
+} compiler_t;
+
+static void compile_form(compiler_t *c, obp_t form);
+
+
+static void emit_byte(compiler_t *c, uint byte)
+{
+        if (c->length >= c->size) {
+                c->size = c->size ? 2 * c->size : 64;
+                c->code = xrealloc(c->code, c->size, "bytecode");
+        }
+        c->code[c->length++] = byte;
+}
+
+static void emit_operand(compiler_t *c, uint operand)
+{
+        if (operand > 0xffff) {
+                c->too_large = 1;
+        }
+        emit_byte(c, operand & 0xff);
+        emit_byte(c, (operand >> 8) & 0xff);
+}
+
+/**
+ * Account for an instruction changing the stack depth by delta.
+ */
+static void adjust_depth(compiler_t *c, int delta)
+{
+        c->depth += delta;
+        if (c->depth > c->maxdepth) {
+                c->maxdepth = c->depth;
+        }
+}
+
+static void emit_op(compiler_t *c, opcode_t op, int delta)
+{
+        emit_byte(c, op);
+        adjust_depth(c, delta);
+}
+
+static void emit_op_operand(compiler_t *c, opcode_t op, uint operand,
+                            int delta)
+{
+        emit_op(c, op, delta);
+        emit_operand(c, operand);
+}
+
+/**
+ * Return the index of a constant in the code vector, adding it if necessary.
+ */
+static uint const_index(compiler_t *c, obp_t ob)
+{
+        for (uint i = 0; i < c->nconsts; i++) {
+                if (c->consts[i] == ob) {
+                        return i + 1;
+                }
+        }
+        if (c->nconsts >= c->consts_size) {
+                c->consts_size = c->consts_size ? 2 * c->consts_size : 16;
+                c->consts = xrealloc(c->consts, c->consts_size * sizeof(obp_t),
+                                     "bytecode constants");
+        }
+        c->consts[c->nconsts++] = ob;
+        return c->nconsts;
+}
+
+static void emit_const(compiler_t *c, obp_t ob)
+{
+        emit_op_operand(c, OP_CONST, const_index(c, ob), 1);
+}
+
+/**
+ * Emit a jump with the target still open; return the position of the operand
+ * for patch_jump().
+ */
+static uint emit_jump(compiler_t *c, opcode_t op, int delta)
+{
+        emit_op_operand(c, op, 0, delta);
+        return c->length - 2;
+}
+
+/**
+ * Set the target of a jump to the current position.
+ */
+static void patch_jump(compiler_t *c, uint at)
+{
+        if (c->length > 0xffff) {
+                c->too_large = 1;
+        }
+        c->code[at] = c->length & 0xff;
+        c->code[at + 1] = (c->length >> 8) & 0xff;
+}
+
+/**
+ * Return the length of a proper list, or -1 if it is not one.
+ */
+static int proper_length(obp_t list)
+{
+        int length = 0;
+
+        for ( ; IS(list, PAIR); list = CDR(list)) {
+                length++;
+        }
+        return IS_NIL(list) ? length : -1;
+}
+
+/**
+ * Compile a list of forms that leaves the value of the last one (or nil) on
+ * the stack.
+ */
+static void compile_body(compiler_t *c, obp_t body)
+{
+        if (IS_NIL(body)) {
+                emit_const(c, the_Nil);
+                return;
+        }
+        for ( ; IS(body, PAIR); body = CDR(body)) {
+                compile_form(c, CAR(body));
+                if (!IS_NIL(CDR(body))) {
+                        emit_op(c, OP_POP, -1);
+                }
+        }
+}
+
+
+/* The compilers of special forms get the argument list of the form and its
+ * length. They return zero, without having emitted anything, if the form is
+ * malformed.
+ */
+
+static int compile_quote(compiler_t *c, obp_t args, int nargs)
+{
+        if (nargs != 1) {
+                return 0;
+        }
+        emit_const(c, CAR(args));
+        return 1;
+}
+
+static int compile_progn(compiler_t *c, obp_t args, int nargs)
+{
+        compile_body(c, args);
+        return 1;
+}
+
+static int compile_if(compiler_t *c, obp_t args, int nargs)
+{
+        if (nargs == 0) {
+                emit_const(c, the_Nil);
+                return 1;
+        }
+        compile_form(c, CAR(args));
+        uint to_else = emit_jump(c, OP_JUMPNIL, -1);
+        if (nargs >= 2) {
+                compile_form(c, CADR(args));
+        } else {
+                emit_const(c, the_Nil);
+        }
+        uint to_end = emit_jump(c, OP_JUMP, 0);
+        adjust_depth(c, -1);
+        patch_jump(c, to_else);
+        compile_body(c, nargs >= 2 ? CDR(CDR(args)) : the_Nil);
+        patch_jump(c, to_end);
+        return 1;
+}
+
+static void compile_clauses(compiler_t *c, obp_t clauses)
+{
+        if (IS_NIL(clauses)) {
+                emit_const(c, the_Nil);
+                return;
+        }
+        obp_t clause = CAR(clauses);
+        compile_form(c, CAR(clause));
+        if (IS_NIL(CDR(clause))) {
+                /* the value of the test is the value of the cond */
+                uint to_end = emit_jump(c, OP_JUMPNOTNILKEEP, -1);
+                compile_clauses(c, CDR(clauses));
+                patch_jump(c, to_end);
+        } else {
+                uint to_next = emit_jump(c, OP_JUMPNIL, -1);
+                compile_body(c, CDR(clause));
+                uint to_end = emit_jump(c, OP_JUMP, 0);
+                adjust_depth(c, -1);
+                patch_jump(c, to_next);
+                compile_clauses(c, CDR(clauses));
+                patch_jump(c, to_end);
+        }
+}
+
+static int compile_cond(compiler_t *c, obp_t args, int nargs)
+{
+        for (obp_t clauses = args; IS(clauses, PAIR); clauses = CDR(clauses)) {
+                obp_t clause = CAR(clauses);
+                if (!IS(clause, PAIR) || proper_length(clause) < 0) {
+                        return 0;
+                }
+        }
+        compile_clauses(c, args);
+        return 1;
+}
+
+static int compile_while(compiler_t *c, obp_t args, int nargs)
+{
+        if (nargs == 0) {
+                return 0;
+        }
+        uint loop = c->length;
+        compile_form(c, CAR(args));
+        uint to_end = emit_jump(c, OP_JUMPNIL, -1);
+        for (obp_t body = CDR(args); IS(body, PAIR); body = CDR(body)) {
+                compile_form(c, CAR(body));
+                emit_op(c, OP_POP, -1);
+        }
+        emit_op_operand(c, OP_JUMP, loop, 0);
+        patch_jump(c, to_end);
+        emit_const(c, the_Nil);
+        return 1;
+}
+
+static int compile_setq(compiler_t *c, obp_t args, int nargs)
+{
+        if (nargs % 2 != 0) {
+                return 0;
+        }
+        for (obp_t pairs = args; IS(pairs, PAIR); pairs = CDR(CDR(pairs))) {
+                obp_t sym = CAR(pairs);
+                if (!IS(sym, SYMBOL) || sym->immutable) {
+                        return 0;
+                }
+        }
+        if (nargs == 0) {
+                emit_const(c, the_Nil);
+                return 1;
+        }
+        for (obp_t pairs = args; IS(pairs, PAIR); pairs = CDR(CDR(pairs))) {
+                compile_form(c, CADR(pairs));
+                emit_op_operand(c, OP_VARSET, const_index(c, CAR(pairs)), 0);
+                if (!IS_NIL(CDR(CDR(pairs)))) {
+                        emit_op(c, OP_POP, -1);
+                }
+        }
+        return 1;
+}
+
+/**
+ * Return the symbol of a let binding, or 0 if the binding is malformed.
+ */
+static obp_t binding_symbol(obp_t binding)
+{
+        if (IS(binding, SYMBOL)) {
+                return binding;
+        }
+        if (IS(binding, PAIR) && IS(CAR(binding), SYMBOL)
+            && IS(CDR(binding), PAIR) && IS_NIL(CDR(CDR(binding)))) {
+                return CAR(binding);
+        }
+        return 0;
+}
+
+static void compile_binding_value(compiler_t *c, obp_t binding)
+{
+        if (IS(binding, SYMBOL)) {
+                emit_const(c, the_Nil);
+        } else {
+                compile_form(c, CADR(binding));
+        }
+}
+
+/**
+ * Compile let or, if sequential, let*. For let, all values are pushed first
+ * and then bound from the last to the first, which is the order the
+ * interpreter binds them in, too.
+ */
+static int compile_let_common(compiler_t *c, obp_t args, int nargs,
+                              int sequential)
+{
+        if (nargs == 0) {
+                return 0;
+        }
+        obp_t bindings = CAR(args);
+        int nbindings = proper_length(bindings);
+        if (nbindings < 0) {
+                return 0;
+        }
+        for (obp_t b = bindings; IS(b, PAIR); b = CDR(b)) {
+                if (!binding_symbol(CAR(b))) {
+                        return 0;
+                }
+        }
+
+        for (obp_t b = bindings; IS(b, PAIR); b = CDR(b)) {
+                compile_binding_value(c, CAR(b));
+                if (sequential) {
+                        emit_op_operand(c, OP_BIND,
+                                        const_index(c, binding_symbol(CAR(b))),
+                                        -1);
+                }
+        }
+        if (!sequential) {
+                for (int i = nbindings - 1; i >= 0; i--) {
+                        obp_t b = bindings;
+                        for (int j = 0; j < i; j++) {
+                                b = CDR(b);
+                        }
+                        emit_op_operand(c, OP_BIND,
+                                        const_index(c, binding_symbol(CAR(b))),
+                                        -1);
+                }
+        }
+        compile_body(c, CDR(args));
+        if (nbindings) {
+                emit_op_operand(c, OP_UNBIND, nbindings, 0);
+        }
+        return 1;
+}
+
+static int compile_let(compiler_t *c, obp_t args, int nargs)
+{
+        return compile_let_common(c, args, nargs, 0);
+}
+
+static int compile_letrec(compiler_t *c, obp_t args, int nargs)
+{
+        return compile_let_common(c, args, nargs, 1);
+}
+
+/**
+ * Compile and or or: each form but the last one jumps to the end with its
+ * value if it is nil (for and) or non-nil (for or).
+ */
+static void compile_junction(compiler_t *c, obp_t forms, opcode_t jump)
+{
+        compile_form(c, CAR(forms));
+        if (!IS_NIL(CDR(forms))) {
+                uint to_end = emit_jump(c, jump, -1);
+                compile_junction(c, CDR(forms), jump);
+                patch_jump(c, to_end);
+        }
+}
+
+static int compile_and(compiler_t *c, obp_t args, int nargs)
+{
+        if (nargs == 0) {
+                emit_const(c, the_T);
+        } else {
+                compile_junction(c, args, OP_JUMPNILKEEP);
+        }
+        return 1;
+}
+
+static int compile_or(compiler_t *c, obp_t args, int nargs)
+{
+        if (nargs == 0) {
+                emit_const(c, the_Nil);
+        } else {
+                compile_junction(c, args, OP_JUMPNOTNILKEEP);
+        }
+        return 1;
+}
+
+static struct {
+        builtin_func_t *builtin;
+        int (*compile)(compiler_t *c, obp_t args, int nargs);
+} special_forms[] = {
+        { bf_quote, compile_quote },
+        { bf_progn, compile_progn },
+        { bf_if, compile_if },
+        { bf_cond, compile_cond },
+        { bf_while, compile_while },
+        { bf_setq, compile_setq },
+        { bf_let, compile_let },
+        { bf_letrec, compile_letrec },
+        { bf_and, compile_and },
+        { bf_or, compile_or },
+        { 0, 0 }
+};
+
+/**
+ * Compile a call of a builtin to a dedicated instruction or special form code;
+ * return zero if there is none for this call.
+ */
+static int compile_builtin(compiler_t *c, obp_t fun, obp_t args, int nargs)
+{
+        Lfunction_t *func = AS(fun, FUNCTION);
+
+        for (int i = 0; special_forms[i].builtin && !func->argv; i++) {
+                if (special_forms[i].builtin == func->impl.builtin) {
+                        return special_forms[i].compile(c, args, nargs);
+                }
+        }
+        for (int i = 0; builtin_ops[i].builtin && func->argv; i++) {
+                if (builtin_ops[i].builtin == func->impl.builtin_argv
+                    && builtin_ops[i].nargs == nargs) {
+                        for ( ; IS(args, PAIR); args = CDR(args)) {
+                                compile_form(c, CAR(args));
+                        }
+                        emit_op(c, builtin_ops[i].op, 1 - nargs);
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+static void compile_form(compiler_t *c, obp_t form)
+{
+        if (IS(form, SYMBOL)) {
+                if (form == the_Nil || form == the_T) {
+                        emit_const(c, form);
+                } else {
+                        emit_op_operand(c, OP_VARREF, const_index(c, form), 1);
+                }
+                return;
+        }
+        if (!IS(form, PAIR)) {
+                emit_const(c, form);
+                return;
+        }
+
+        obp_t head = CAR(form);
+        obp_t args = CDR(form);
+        int nargs = proper_length(args);
+        if (IS(head, SYMBOL) && nargs >= 0) {
+                obp_t fun = AS(head, SYMBOL)->function;
+                if (fun && IS_BUILTIN(fun)
+                    && compile_builtin(c, fun, args, nargs)) {
+                        return;
+                }
+                if ((fun == 0 || !IS_SPECIAL(fun)) && nargs <= 0xff) {
+                        uint past_call = 0;
+                        if (!fun || !IS_BUILTIN(fun)) {
+                                emit_op_operand(c, OP_IFSPECIAL,
+                                                const_index(c, form), 0);
+                                past_call = c->length;
+                                emit_operand(c, 0);
+                        }
+                        for ( ; IS(args, PAIR); args = CDR(args)) {
+                                compile_form(c, CAR(args));
+                        }
+                        emit_op_operand(c, OP_CALL, const_index(c, head),
+                                        1 - nargs);
+                        emit_byte(c, nargs);
+                        if (past_call) {
+                                patch_jump(c, past_call);
+                        }
+                        return;
+                }
+        }
+        emit_op_operand(c, OP_EVAL, const_index(c, form), 1);
+}
+
+
+int compile_function(obp_t fun)
+{
+        Lfunction_t *func = AS(fun, FUNCTION);
+        compiler_t comp;
+        compiler_t *c = &comp;
+        int success = 0;
+
+        if (func->type == F_BYTECODE) {
+                return 1;
+        }
+        assert(func->type == F_FORM);
+        if (func->lexical) {
+                return 0;
+        }
+        memset(c, 0, sizeof(*c));
+        emit_operand(c, 0);             /* the stack depth, see below */
+        compile_body(c, CDR(CDR(func->impl.form)));
+        emit_op(c, OP_RETURN, -1);
+        c->code[0] = c->maxdepth & 0xff;
+        c->code[1] = (c->maxdepth >> 8) & 0xff;
+
+        if (!c->too_large && c->maxdepth <= 0xffff) {
+                PROTECT;
+                PROTVAL(bytes, new_string((char *) c->code, c->length));
+                PROTVAL(vec, new_vector(c->nconsts + 1));
+                Lvector_t *v = AS(vec, VECTOR);
+                v->elem[0] = bytes;
+                memcpy(v->elem + 1, c->consts, c->nconsts * sizeof(obp_t));
+                v->nelem = c->nconsts + 1;
+                func->code = vec;
+                gc_write_barrier(fun, vec);
+                func->type = F_BYTECODE;
+                UNPROTECT;
+                success = 1;
+        }
+        xfree(c->code);
+        xfree(c->consts);
+        return success;
+}
+
+
+/**
+ * Call the builtin an instruction stands for with the arguments from the
+ * stack. This is the slow path of these instructions, for the arguments their
+ * fast path does not handle, including the erroneous ones.
+ */
+static obp_t call_op_builtin(opcode_t op, obp_t *argv, session_context_t *sc,
+                             int level)
+{
+        int i;
+
+        for (i = 0; builtin_ops[i].op != op; i++) {
+                ;
+        }
+        return builtin_ops[i].builtin(builtin_ops[i].nargs, argv, sc, level);
+}
+
+#define NUM(ob) INT_VALUE(ob)
+#define BOTH_INT(a, b) (IS(a, NUMBER) && IS_INT(a) \
+                        && IS(b, NUMBER) && IS_INT(b))
+
+#define PUSH(ob) (*sp++ = (ob))
+#define POP() (*--sp)
+#define TOP (sp[-1])
+#define NEXT goto *dispatch[*pc++]
+
+/* Calls may run nested code that enlarges (and moves) the value stack. */
+#define CALLOUT(var, expr)                                              \
+        do {                                                            \
+                long sp_offset_ = sp - value_stack;                     \
+                var = (expr);                                           \
+                sp = value_stack + sp_offset_;                          \
+        } while (0)
+
+/* the slow path of an instruction with n arguments; the builtins called do not
+ * evaluate anything, so the stack stays in place
+ */
+#define SLOW_OP(op, n)                                                  \
+        do {                                                            \
+                value = call_op_builtin(op, sp - (n), sc, level);       \
+                CHECK_ERROR(value);                                     \
+                sp -= (n);                                              \
+                PUSH(value);                                            \
+        } while (0)
+
+static vm_frame_t *push_frame(void)
+{
+        if (vm_frames_top >= vm_frames_size) {
+                vm_frames_size = vm_frames_size ? 2 * vm_frames_size
+                                                : VM_FRAMES_INITIAL;
+                vm_frames = xrealloc(vm_frames,
+                                     vm_frames_size * sizeof(vm_frame_t),
+                                     "VM frame stack");
+        }
+        return &vm_frames[vm_frames_top++];
+}
+
+/**
+ * Return non-zero iff the instruction at pc returns, possibly after jumps.
+ */
+static int returns_next(uchar *code, uchar *pc)
+{
+        while (*pc == OP_JUMP) {
+                pc = code + OPERAND(pc + 1);
+        }
+        return *pc == OP_RETURN;
+}
+
+/**
+ * Return non-zero if a call of the symbol must not be run with evaluated
+ * arguments: it is (or has as its value) a special form, macro, mu function,
+ * or autoload function, or is no function at all, so eval() reports that.
+ */
+static int special_head(obp_t sym)
+{
+        obp_t fun = AS(sym, SYMBOL)->function;
+
+        if (!fun) {
+                fun = AS(sym, SYMBOL)->value;
+        }
+        if (!fun) {
+                return 1;
+        }
+        if (IS(fun, PAIR)) {
+                return CAR(fun) == the_Mu;
+        }
+        return !IS(fun, FUNCTION) || IS_SPECIAL(fun) || IS_AUTOLOAD(fun);
+}
+
+obp_t vm_run(obp_t fun, session_context_t *sc, int level, tail_call_t *tail)
+{
+        static void *dispatch[OP_COUNT] = {
+                [OP_CONST] = &&op_const,
+                [OP_VARREF] = &&op_varref,
+                [OP_VARSET] = &&op_varset,
+                [OP_POP] = &&op_pop,
+                [OP_JUMP] = &&op_jump,
+                [OP_JUMPNIL] = &&op_jumpnil,
+                [OP_JUMPNILKEEP] = &&op_jumpnilkeep,
+                [OP_JUMPNOTNILKEEP] = &&op_jumpnotnilkeep,
+                [OP_BIND] = &&op_bind,
+                [OP_UNBIND] = &&op_unbind,
+                [OP_CALL] = &&op_call,
+                [OP_EVAL] = &&op_eval,
+                [OP_IFSPECIAL] = &&op_ifspecial,
+                [OP_ADD] = &&op_add,
+                [OP_SUB] = &&op_sub,
+                [OP_MUL] = &&op_mul,
+                [OP_ADD1] = &&op_add1,
+                [OP_SUB1] = &&op_sub1,
+                [OP_NUMEQ] = &&op_numeq,
+                [OP_LT] = &&op_lt,
+                [OP_GT] = &&op_gt,
+                [OP_LE] = &&op_le,
+                [OP_GE] = &&op_ge,
+                [OP_CAR] = &&op_car,
+                [OP_CDR] = &&op_cdr,
+                [OP_CONS] = &&op_cons,
+                [OP_EQ] = &&op_eq,
+                [OP_NULL] = &&op_null,
+                [OP_RETURN] = &&op_return,
+        };
+        PROTECT;
+        PROTVAL(self, fun);
+        PROTVAR(retval);
+        PROTVAR(args);
+        obp_t *consts = AS(AS(self, FUNCTION)->code, VECTOR)->elem;
+        uchar *code = (uchar *) AS(consts[0], STRING)->content;
+        uchar *pc = code + 2;
+        uint depth = specpdl_top;
+        uint mark = depth;              /* binding stack depth in the body */
+        uint entry = vm_frames_top;
+        uint entry_base = reserve_values(OPERAND(code));
+        uint base = entry_base;
+        obp_t *sp = value_stack + base;
+        obp_t a;
+        obp_t b;
+        obp_t value;
+        long n;                         /* result of integer arithmetic */
+
+        NEXT;
+
+    op_const:
+        PUSH(consts[OPERAND(pc)]);
+        pc += 2;
+        NEXT;
+    op_varref:
+        a = consts[OPERAND(pc)];
+        pc += 2;
+        value = AS(a, SYMBOL)->value;
+        if (!value) {
+                ERROR(sc->out, ERR_EVAL, a, "symbol undefined");
+        }
+        PUSH(value);
+        NEXT;
+    op_varset:
+        a = consts[OPERAND(pc)];
+        pc += 2;
+        if (a->immutable) {
+                ERROR(sc->out, ERR_IMMUTBL, a,
+                      "symbol value may not be modified");
+        }
+        AS(a, SYMBOL)->value = TOP;
+        gc_write_barrier(a, TOP);
+        NEXT;
+    op_pop:
+        sp--;
+        NEXT;
+    op_jump:
+        pc = code + OPERAND(pc);
+        NEXT;
+    op_jumpnil:
+        if (IS_NIL(POP())) {
+                pc = code + OPERAND(pc);
+        } else {
+                pc += 2;
+        }
+        NEXT;
+    op_jumpnilkeep:
+        if (IS_NIL(TOP)) {
+                pc = code + OPERAND(pc);
+        } else {
+                sp--;
+                pc += 2;
+        }
+        NEXT;
+    op_jumpnotnilkeep:
+        if (!IS_NIL(TOP)) {
+                pc = code + OPERAND(pc);
+        } else {
+                sp--;
+                pc += 2;
+        }
+        NEXT;
+    op_bind:
+        a = consts[OPERAND(pc)];
+        pc += 2;
+        specbind(a, POP());
+        bind_count++;
+        NEXT;
+    op_unbind:
+        unbind_to(specpdl_top - OPERAND(pc));
+        pc += 2;
+        NEXT;
+    op_call: {
+        int nargs = pc[2];
+        a = consts[OPERAND(pc)];
+        pc += 3;
+        b = AS(a, SYMBOL)->function;
+        if (b && IS_BUILTIN(b) && AS(b, FUNCTION)->argv
+            && !AS(b, FUNCTION)->trace) {
+                apply_count++;
+                value = call_builtin_argv(b, nargs, sp - nargs, sc, level + 1);
+                CHECK_ERROR(value);
+                sp -= nargs;
+                PUSH(value);
+                NEXT;
+        }
+        args = the_Nil;
+        for (int i = 1; i <= nargs; i++) {
+                args = new_pair(sp[-i], args);
+        }
+        sp -= nargs;
+        if (!b || !(IS_FORM(b) || IS_BYTECODE(b)) || AS(b, FUNCTION)->is_special
+            || AS(b, FUNCTION)->trace) {
+                /* not a Lisp function */
+        } else if (specpdl_top == mark && returns_next(code, pc)
+                   && (vm_frames_top == entry || IS_BYTECODE(b))) {
+                /* a call in tail position */
+                if (vm_frames_top == entry) {
+                        tail->fun = b;
+                        tail->args = args;
+                        retval = the_Nil;
+                        goto EXIT;
+                }
+                value_stack_top = base;
+                apply_count++;
+                value = bind_lambda_list(b, args,
+                                         vm_frames[vm_frames_top - 1].unbind,
+                                         sc, level);
+                CHECK_ERROR(value);
+                goto enter;
+        } else if (IS_BYTECODE(b)) {
+                vm_frame_t *f = push_frame();
+                f->fun = self;
+                f->pc = pc - code;
+                f->base = base;
+                f->sp = sp - value_stack;
+                f->mark = mark;
+                f->unbind = specpdl_top;
+                f->level = level++;
+                call_depth++;
+                apply_count++;
+                value = check_depth(b, sc);
+                if (value) {
+                        retval = value;
+                        goto EXIT;
+                }
+                value = bind_lambda_list(b, args, specpdl_top, sc, level);
+                CHECK_ERROR(value);
+                goto enter;
+        }
+        CALLOUT(value, funcall_values(a, args, sc, level + 1));
+        CHECK_ERROR(value);
+        PUSH(value);
+        NEXT;
+    }
+    enter:
+        /* start running b, with its parameters bound */
+        self = b;
+        consts = AS(AS(self, FUNCTION)->code, VECTOR)->elem;
+        code = (uchar *) AS(consts[0], STRING)->content;
+        pc = code + 2;
+        mark = specpdl_top;
+        base = reserve_values(OPERAND(code));
+        sp = value_stack + base;
+        NEXT;
+    op_ifspecial:
+        a = consts[OPERAND(pc)];
+        if (!special_head(CAR(a))) {
+                pc += 4;
+                NEXT;
+        }
+        pc = code + OPERAND(pc + 2);
+        goto eval_form;
+    op_eval:
+        a = consts[OPERAND(pc)];
+        pc += 2;
+    eval_form:
+        if (specpdl_top == mark && vm_frames_top == entry
+            && returns_next(code, pc) && (b = macro_of(a))) {
+                /* a macro call in tail position */
+                CALLOUT(value, eval_macro(a, b, sc, level + 1, tail));
+                CHECK_ERROR(value);
+                if (tail->fun) {
+                        retval = value;
+                        goto EXIT;
+                }
+                PUSH(value);
+                NEXT;
+        }
+        CALLOUT(value, eval(a, sc, level));
+        CHECK_ERROR(value);
+        PUSH(value);
+        NEXT;
+    op_add:
+        a = sp[-2];
+        b = sp[-1];
+        if (BOTH_INT(a, b)
+            && !__builtin_add_overflow(NUM(a), NUM(b), &n)) {
+                sp--;
+                TOP = new_integer(n);
+        } else {
+                SLOW_OP(OP_ADD, 2);
+        }
+        NEXT;
+    op_sub:
+        a = sp[-2];
+        b = sp[-1];
+        if (BOTH_INT(a, b)
+            && !__builtin_sub_overflow(NUM(a), NUM(b), &n)) {
+                sp--;
+                TOP = new_integer(n);
+        } else {
+                SLOW_OP(OP_SUB, 2);
+        }
+        NEXT;
+    op_mul:
+        a = sp[-2];
+        b = sp[-1];
+        if (BOTH_INT(a, b)
+            && !__builtin_mul_overflow(NUM(a), NUM(b), &n)) {
+                sp--;
+                TOP = new_integer(n);
+        } else {
+                SLOW_OP(OP_MUL, 2);
+        }
+        NEXT;
+    op_add1:
+        a = TOP;
+        if (IS(a, NUMBER) && IS_INT(a)
+            && !__builtin_add_overflow(NUM(a), 1, &n)) {
+                TOP = new_integer(n);
+        } else {
+                SLOW_OP(OP_ADD1, 1);
+        }
+        NEXT;
+    op_sub1:
+        a = TOP;
+        if (IS(a, NUMBER) && IS_INT(a)
+            && !__builtin_sub_overflow(NUM(a), 1, &n)) {
+                TOP = new_integer(n);
+        } else {
+                SLOW_OP(OP_SUB1, 1);
+        }
+        NEXT;
+    op_numeq:
+        a = sp[-2];
+        b = sp[-1];
+        if (BOTH_INT(a, b)) {
+                sp--;
+                TOP = NUM(a) == NUM(b) ? the_T : the_Nil;
+        } else {
+                SLOW_OP(OP_NUMEQ, 2);
+        }
+        NEXT;
+    op_lt:
+        a = sp[-2];
+        b = sp[-1];
+        if (BOTH_INT(a, b)) {
+                sp--;
+                TOP = NUM(a) < NUM(b) ? the_T : the_Nil;
+        } else {
+                SLOW_OP(OP_LT, 2);
+        }
+        NEXT;
+    op_gt:
+        a = sp[-2];
+        b = sp[-1];
+        if (BOTH_INT(a, b)) {
+                sp--;
+                TOP = NUM(a) > NUM(b) ? the_T : the_Nil;
+        } else {
+                SLOW_OP(OP_GT, 2);
+        }
+        NEXT;
+    op_le:
+        a = sp[-2];
+        b = sp[-1];
+        if (BOTH_INT(a, b)) {
+                sp--;
+                TOP = NUM(a) <= NUM(b) ? the_T : the_Nil;
+        } else {
+                SLOW_OP(OP_LE, 2);
+        }
+        NEXT;
+    op_ge:
+        a = sp[-2];
+        b = sp[-1];
+        if (BOTH_INT(a, b)) {
+                sp--;
+                TOP = NUM(a) >= NUM(b) ? the_T : the_Nil;
+        } else {
+                SLOW_OP(OP_GE, 2);
+        }
+        NEXT;
+    op_car:
+        a = TOP;
+        if (IS(a, PAIR)) {
+                TOP = CAR(a);
+        } else if (!IS_NIL(a)) {
+                SLOW_OP(OP_CAR, 1);
+        }
+        NEXT;
+    op_cdr:
+        a = TOP;
+        if (IS(a, PAIR)) {
+                TOP = CDR(a);
+        } else if (!IS_NIL(a)) {
+                SLOW_OP(OP_CDR, 1);
+        }
+        NEXT;
+    op_cons:
+        value = new_pair(sp[-2], sp[-1]);
+        sp--;
+        TOP = value;
+        NEXT;
+    op_eq:
+        sp--;
+        TOP = TOP == sp[0] ? the_T : the_Nil;
+        NEXT;
+    op_null:
+        TOP = IS_NIL(TOP) ? the_T : the_Nil;
+        NEXT;
+    op_return:
+        retval = POP();
+        if (vm_frames_top > entry) {
+                /* return to the calling bytecode function */
+                vm_frame_t *f = &vm_frames[--vm_frames_top];
+                call_depth--;
+                unbind_to(f->unbind);
+                value_stack_top = base;
+                self = f->fun;
+                consts = AS(AS(self, FUNCTION)->code, VECTOR)->elem;
+                code = (uchar *) AS(consts[0], STRING)->content;
+                pc = code + f->pc;
+                mark = f->mark;
+                base = f->base;
+                sp = value_stack + f->sp;
+                level = f->level;
+                PUSH(retval);
+                NEXT;
+        }
+
+    EXIT:
+        call_depth -= vm_frames_top - entry;
+        vm_frames_top = entry;
+        unbind_to(depth);
+        value_stack_top = entry_base;
+        UNPROTECT;
+        return retval;
+}
+
+
+/**
+ * Compile a function to bytecode. The argument may also be a symbol, whose
+ * function is compiled then. Return the compiled function.
+ * (compile function)
+ */
+obp_t bf_compile(int nargs, obp_t args, session_context_t *sc, int level)
+{
+        obp_t fun = CAR(args);
+
+        if (IS(fun, SYMBOL)) {
+                if (!AS(fun, SYMBOL)->function) {
+                        return throw_error(sc->out, ERR_NOFUNC, fun,
+                                           "symbol has no function definition");
+                }
+                fun = AS(fun, SYMBOL)->function;
+        }
+        CHECKTYPE_RET(sc->out, fun, FUNCTION);
+        if (!IS_FORM(fun) && !IS_BYTECODE(fun)) {
+                return throw_error(sc->out, ERR_INVARG, fun,
+                                   "not a lambda or mu function");
+        }
+        if (AS(fun, FUNCTION)->lexical) {
+                return throw_error(sc->out, ERR_INVARG, fun,
+                                   "lexical functions are not compiled");
+        }
+        if (!compile_function(fun)) {
+                return throw_error(sc->out, ERR_INVARG, fun,
+                                   "function too large to compile");
+        }
+        return fun;
+}
+
+
+void init_bytecode(void)
+{
+        register_builtin(COMPILE_NAME, bf_compile, 0, 1, 1);
+}
+
+/* EOF */
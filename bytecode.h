@@ -0,0 +1,56 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * The bytecode compiler and virtual machine
+ */
+
+#ifndef __BYTECODE_H_INC
+#define __BYTECODE_H_INC
+
+#include "cbasics.h"
+#include "objects.h"
+
+struct TAIL_CALL;
+
+/**
+ * Compile the body of a lambda or mu function to bytecode, changing it into an
+ * F_BYTECODE function in place. Return non-zero on success, zero if the
+ * function is too large to be compiled or is lexical.
+ */
+int compile_function(obp_t fun);
+
+/**
+ * Run the bytecode of a function, with the parameters already bound, and
+ * return the value. A call of a Lisp function in tail position is not made,
+ * but stored in *tail for apply() to make.
+ */
+obp_t vm_run(obp_t fun, session_context_t *sc, int level,
+             struct TAIL_CALL *tail);
+
+/* The state of a bytecode function that has called another one, which vm_run()
+ * runs in the same invocation instead of recursively; the GC scans the frames
+ * up to the top.
+ */
+typedef struct VM_FRAME {
+        obp_t fun;                      /* the calling function */
+        uint pc;                        /* offset of its next instruction */
+        uint base;                      /* value stack index of its values */
+        uint sp;                        /* value stack index of its top */
+        uint mark;                      /* binding stack depth in its body */
+        uint unbind;                    /* binding stack depth at the call */
+        int level;
+} vm_frame_t;
+
+extern vm_frame_t *vm_frames;
+extern uint vm_frames_top;
+
+/**
+ * Register the builtin functions of the bytecode module.
+ */
+void init_bytecode(void);
+
+extern int compile_on_defun;            /* compile functions when defined */
+
+
+#endif  /* __BYTECODE_H_INC */
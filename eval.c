@@ -4,7 +4,10 @@
 
 #include "cbasics.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <sys/resource.h>
 #include "objects.h"
+#include "xmemory.h"
 #include "eval.h"
 #include "signals.h"
 #include "printer.h"
@@ -12,81 +15,280 @@
 #include "io.h"
 #include "builtins.h"
 #include "gc.h"
+#include "bytecode.h"
+#include "analyze.h"
 
 long eval_count = 0;
 long apply_count = 0;
 long bind_count = 0;
+ulong function_epoch = 1;               /* incremented by set_function() */
+uint call_depth = 0;
+uint max_depth = MAX_DEPTH;
+obp_t lambda_cache[LAMBDA_CACHE_SIZE];
+macro_expansion_t macro_cache[MACRO_CACHE_SIZE];
+static uintptr_t stack_limit = 0;       /* lowest usable C stack address, or 0
+                                           if unknown */
+
+builtin_func_t bf_if, bf_cond, bf_progn;
+
+obp_t *value_stack;
+uint value_stack_top;                   /* index of the next free entry */
+static uint value_stack_size;           /* number of allocated entries */
+
+
+uint reserve_values(uint n)
+{
+        uint base = value_stack_top;
+
+        if (base + n > value_stack_size) {
+                while (base + n > value_stack_size) {
+                        value_stack_size = value_stack_size
+                                ? 2 * value_stack_size : VALUE_STACK_INITIAL;
+                }
+                value_stack = xrealloc(value_stack,
+                                       value_stack_size * sizeof(obp_t),
+                                       "value stack");
+        }
+        for (uint i = 0; i < n; i++) {
+                value_stack[base + i] = the_Nil;
+        }
+        value_stack_top = base + n;
+        return base;
+}
 
 /**
- * return a function object if argument is a proper function
+ * Return non-zero iff less than C_STACK_RESERVE bytes of the C stack are left.
+ * The stack is assumed to grow downwards.
  */
-obp_t make_function(char *name, uint namelen, obp_t func, session_context_t *sc)
+static int stack_exhausted(void)
 {
-        PROTECT;
-        short minargs = 0;
-        short maxargs = 0;
-        PROTVAR(retval);
-        
-        if (IS(func, FUNCTION)) {
-                return func;
-        }
-        if (!IS(func, PAIR)) {
-                ERROR(sc->out, ERR_NOFUNC, func, "not function object or list");
+        char here;
+
+        return (uintptr_t) &here < stack_limit;
+}
+
+obp_t check_depth(obp_t fun, session_context_t *sc)
+{
+        if (call_depth > max_depth) {
+                return throw_error(sc->out, ERR_DEPTH, fun,
+                                   "more than %u nested calls", max_depth);
         }
-        obp_t marker = CAR(func);
-        if (marker != the_Lambda && marker != the_Mu) {
-                ERROR(sc->out, ERR_NOFUNC, func,
-                      "is not builtin or lambda or special form");
+        if (stack_exhausted()) {
+                return throw_error(sc->out, ERR_DEPTH, fun,
+                                   "C stack exhausted");
         }
-        obp_t body = CDR(func);
-        if (!IS(body, PAIR)) {
-                ERROR(sc->out, ERR_NOFUNC, func,
-                      "lambda or special form body is not a list");
+        return 0;
+}
+
+/**
+ * Find the limit of the C stack from the resource limit, relative to the
+ * current stack depth; must be called early in main().
+ */
+void init_eval(void)
+{
+        struct rlimit rl;
+        char here;
+
+        if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+            && rl.rlim_cur > 2 * C_STACK_RESERVE) {
+                stack_limit = (uintptr_t) &here - rl.rlim_cur
+                        + C_STACK_RESERVE;
         }
-        obp_t arglist = CAR(body);
-        /* arglist of the form (sym sym sym) or (sym sym . sym) */
-        while (IS(arglist, PAIR)) {
+}
+
+/**
+ * Parse a lambda list of the form (req ... &optional opt ... &rest rest),
+ * where an optional parameter may also be a list (opt init) with the form of
+ * its default value, and (req ... . rest) is the same as (req ... &rest rest).
+ * Return 0 if the list is proper, or else a description of what is wrong.
+ * Count the parameters into *ll and, if param is not 0, store them there.
+ */
+static char *parse_lambda_list(obp_t arglist, lambda_list_t *ll,
+                               param_t *param)
+{
+        enum { REQUIRED, OPTIONAL, REST, DONE } state = REQUIRED;
+
+        ll->nreq = ll->nopt = ll->rest = 0;
+        for ( ; IS(arglist, PAIR); arglist = CDR(arglist)) {
                 obp_t sym = CAR(arglist);
+                obp_t init = 0;
+                if (sym == the_Optional) {
+                        if (state != REQUIRED) {
+                                return "misplaced &optional";
+                        }
+                        state = OPTIONAL;
+                        continue;
+                }
+                if (sym == the_Rest) {
+                        if (state > OPTIONAL) {
+                                return "misplaced &rest";
+                        }
+                        state = REST;
+                        continue;
+                }
+                if (state == DONE) {
+                        return "more than one &rest parameter";
+                }
+                if (state == OPTIONAL && IS(sym, PAIR)) {
+                        if (!IS_NIL(CDR(sym)) && !(IS(CDR(sym), PAIR)
+                                                   && IS_NIL(CDR(CDR(sym))))) {
+                                return "optional parameter not (sym init)";
+                        }
+                        init = IS_NIL(CDR(sym)) ? 0 : CADR(sym);
+                        sym = CAR(sym);
+                }
                 if (!IS(sym, SYMBOL)) {
-                        ERROR(sc->out, ERR_NOFUNC, func,
-                              "argument list member is not a symbol");
+                        return "argument list member is not a symbol";
+                }
+                if (param) {
+                        param->symbol = sym;
+                        param->init = init;
+                        param++;
+                }
+                switch (state) {
+                    case REQUIRED: ll->nreq++; break;
+                    case OPTIONAL: ll->nopt++; break;
+                    default: ll->rest = 1; state = DONE; break;
                 }
-                minargs++;
-                maxargs++;
-                arglist = CDR(arglist);
         }
         if (!IS_NIL(arglist)) {
-                if (IS(arglist, SYMBOL)) {
-                        maxargs = -1;
-                } else {
-                        ERROR(sc->out, ERR_NOFUNC, func,
-                              "argument list end not nil or symbol");
+                if (!IS(arglist, SYMBOL)) {
+                        return "argument list end not nil or symbol";
+                }
+                if (state >= REST) {
+                        return "more than one &rest parameter";
                 }
+                if (param) {
+                        param->symbol = arglist;
+                        param->init = 0;
+                }
+                ll->rest = 1;
+        } else if (state == REST) {
+                return "no parameter after &rest";
+        }
+        return 0;
+}
+
+lambda_list_t *new_lambda_list(obp_t arglist)
+{
+        lambda_list_t counts;
+        uint nparams;
+
+        parse_lambda_list(arglist, &counts, 0);
+        nparams = counts.nreq + counts.nopt + counts.rest;
+        lambda_list_t *ll = xmalloc(sizeof(lambda_list_t)
+                                    + nparams * sizeof(param_t),
+                                    "lambda list");
+        parse_lambda_list(arglist, ll, ll->param);
+        return ll;
+}
+
+char *check_form(obp_t func, short *minargs, short *maxargs)
+{
+        lambda_list_t counts;
+        char *problem;
+
+        *minargs = *maxargs = 0;
+        if (!IS(func, PAIR)) {
+                return "not function object or list";
+        }
+        obp_t marker = CAR(func);
+        if (marker != the_Lambda && marker != the_Mu) {
+                return "is not builtin or lambda or special form";
+        }
+        obp_t body = CDR(func);
+        if (!IS(body, PAIR)) {
+                return "lambda or special form body is not a list";
+        }
+        if ((problem = parse_lambda_list(CAR(body), &counts, 0))) {
+                return problem;
         }
+        *minargs = counts.nreq;
+        *maxargs = counts.rest ? -1 : counts.nreq + counts.nopt;
         body = CDR(body);
         while (IS(body, PAIR)) {
                 body = CDR(body);
         }
         if (!IS_NIL(body)) {
-                ERROR(sc->out, ERR_NOFUNC, func, "body is not a proper list");
+                return "body is not a proper list";
+        }
+        return 0;
+}
+
+/**
+ * return a function object if argument is a proper function
+ */
+obp_t make_function(char *name, uint namelen, obp_t func, session_context_t *sc)
+{
+        PROTECT;
+        short minargs;
+        short maxargs;
+        PROTVAR(retval);
+        char *problem;
+        
+        if (IS(func, FUNCTION)) {
+                retval = func;
+                goto EXIT;
+        }
+        if ((problem = check_form(func, &minargs, &maxargs))) {
+                ERROR(sc->out, ERR_NOFUNC, func, "%s", problem);
         }
         retval = new_form_function(name, namelen, func,
-                                   marker == the_Mu, minargs, maxargs);
+                                   CAR(func) == the_Mu, minargs, maxargs);
+        AS(retval, FUNCTION)->params = new_lambda_list(CADR(func));
+        /* anonymous functions are usually made just to be applied once */
+        if (name) {
+                analyze_function(retval);
+        }
     EXIT:
         UNPROTECT;
         return retval;
 }
 
 
-void restore_bindings(obp_t params, int nargs, session_context_t *sc, int level)
+/**
+ * Return the anonymous function of a lambda or mu form that is the head of a
+ * call. The function last made for the form is reused if it was made from
+ * this very form. No builtin modifies a pair once it is made, and the cache
+ * keeps the form alive, so its address cannot be reused for another form and
+ * its lambda list is the one the function was checked with; only the head is
+ * compared again, which is cheap.
+ */
+static obp_t form_function(obp_t form, session_context_t *sc)
+{
+        uint slot = (uintptr_t) form / OBSIZE_UNIT % LAMBDA_CACHE_SIZE;
+        obp_t fun = lambda_cache[slot];
+
+        if (fun && AS(fun, FUNCTION)->impl.form == form
+            && AS(fun, FUNCTION)->is_special == (CAR(form) == the_Mu)) {
+                return fun;
+        }
+        fun = make_function(0, 0, form, sc);
+        if (!IS_EXIT(fun)) {
+                lambda_cache[slot] = fun;
+        }
+        return fun;
+}
+
+
+void set_function(obp_t sym, obp_t func)
+{
+        AS(sym, SYMBOL)->function = func;
+        gc_write_barrier(sym, func);
+        function_epoch++;
+}
+
+/**
+ * Undo the bindings made since the special binding stack had the specified
+ * depth.
+ */
+void restore_bindings(uint depth, session_context_t *sc, int level)
 {
         if (traceflag) {
                 port_printf(sc->out, "%s* unbind ", blanks(level));
         }
-        while (nargs--) {
-                obp_t sym = CAR(params);
-                AS(sym, SYMBOL)->value = popup();
-                params = CDR(params);
+        while (specpdl_top > depth) {
+                obp_t sym = specunbind();
                 if (traceflag) {
                         print_expr((obp_t) sym, 0);
                         port_print(the_Stdout, " to ");
@@ -100,51 +302,59 @@ void restore_bindings(obp_t params, int nargs, session_context_t *sc, int level)
 }
 
 
-obp_t make_bindings(obp_t params, obp_t args, session_context_t *sc, int level)
+void bind_param(obp_t param, obp_t arg, uint merge_from)
+{
+        uint i;
+
+        for (i = specpdl_top; i > merge_from; i--) {
+                if (specpdl[i - 1].symbol == param) {
+                        break;
+                }
+        }
+        if (i > merge_from) {
+                AS(param, SYMBOL)->value = arg;
+                gc_write_barrier(param, arg);
+        } else {
+                specbind(param, arg);
+        }
+        bind_count++;
+        if (traceflag) {
+                print_expr(param, 0);
+                port_print(the_Stdout, " to ");
+                print_expr(arg, 0);
+                port_print(the_Stdout, ", ");
+        }
+}
+
+/**
+ * Return t, or an error, in which case no new bindings are left in place.
+ */
+obp_t bind_params(obp_t params, obp_t args, uint merge_from,
+                  session_context_t *sc, int level)
 {
         PROTECT;
-        PROTVAR(retval);
+        PROTVAL(retval, the_T);
+        uint depth = specpdl_top;
         
         if (traceflag) {
                 printf("%s* bind ", blanks(level));
         }
-        int nargs = 0;                  /* number of bindings actually saved */
         while (IS(args, PAIR) && IS(params, PAIR)) {
-                obp_t car = CAR(params);
-                Lsymbol_t *sym = AS(car, SYMBOL);
-                pushdown(sym->value);
-                sym->value = CAR(args);
-                bind_count++;
-                nargs++;
-                if (traceflag) {
-                        print_expr((obp_t) sym, 0);
-                        port_print(the_Stdout, " to ");
-                        print_expr(sym->value, 0);
-                        port_print(the_Stdout, ", ");
-                }
+                bind_param(CAR(params), CAR(args), merge_from);
                 args = CDR(args);
                 params = CDR(params);
         }
         if (!IS_NIL(params)) {
                 if (IS(params, SYMBOL)) {
-                        Lsymbol_t *sym = AS(params, SYMBOL);
-                        pushdown(sym->value);
-                        sym->value = args;
-                        bind_count++;
-                        if (traceflag) {
-                                print_expr((obp_t) sym, 0);
-                                port_print(the_Stdout, " to ");
-                                print_expr(sym->value, 0);
-                                port_print(the_Stdout, ", ");
-                        }
+                        bind_param(params, args, merge_from);
                 } else {
-                        restore_bindings(params, nargs, sc, level);
+                        restore_bindings(depth, sc, level);
                         ERROR(sc->out, ERR_NOARGS, 0,
                               "too few arguments for function");
                 }
         } else {
                 if (args != the_Nil) {
-                        restore_bindings(params, nargs, sc, level);
+                        restore_bindings(depth, sc, level);
                         ERROR(sc->out, ERR_NOARGS, 0,
                               "too many arguments for function");
                 }
@@ -152,18 +362,262 @@ obp_t make_bindings(obp_t params, obp_t args, session_context_t *sc, int level)
         if (traceflag) {
                 terpri(0);
         }
-        retval = new_integer(nargs);
     EXIT:
         UNPROTECT;
         return retval;
 }
 
 
+obp_t bind_lambda_list(obp_t fun, obp_t args, uint merge_from,
+                       session_context_t *sc, int level)
+{
+        PROTECT;
+        PROTVAL(retval, the_T);
+        PROTVAR(value);
+        lambda_list_t *ll = AS(fun, FUNCTION)->params;
+        uint depth = specpdl_top;
+        uint i = 0;
+
+        protect(fun);
+        protect(args);
+        if (traceflag) {
+                printf("%s* bind ", blanks(level));
+        }
+        for ( ; i < ll->nreq; i++) {
+                if (!IS(args, PAIR)) {
+                        restore_bindings(depth, sc, level);
+                        ERROR(sc->out, ERR_NOARGS, 0,
+                              "too few arguments for function");
+                }
+                bind_param(ll->param[i].symbol, CAR(args), merge_from);
+                args = CDR(args);
+        }
+        for ( ; i < ll->nreq + ll->nopt; i++) {
+                if (IS(args, PAIR)) {
+                        value = CAR(args);
+                        args = CDR(args);
+                } else if (ll->param[i].init) {
+                        value = eval(ll->param[i].init, sc, level + 1);
+                        if (!value || IS_EXIT(value)) {
+                                restore_bindings(depth, sc, level);
+                                retval = value;
+                                goto EXIT;
+                        }
+                } else {
+                        value = the_Nil;
+                }
+                bind_param(ll->param[i].symbol, value, merge_from);
+        }
+        if (ll->rest) {
+                bind_param(ll->param[i].symbol, args, merge_from);
+        } else if (args != the_Nil) {
+                restore_bindings(depth, sc, level);
+                ERROR(sc->out, ERR_NOARGS, 0,
+                      "too many arguments for function");
+        }
+        if (traceflag) {
+                terpri(0);
+        }
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+
+/**
+ * Bind the parameter symbols to the arguments on the special binding stack.
+ * Return t, or an error, in which case no bindings are left in place. The
+ * caller undoes the bindings with restore_bindings() to the depth the stack
+ * had before.
+ */
+obp_t make_bindings(obp_t params, obp_t args, session_context_t *sc, int level)
+{
+        return bind_params(params, args, specpdl_top, sc, level);
+}
+
+
+/**
+ * Return non-zero iff the function of the symbol is the builtin special form
+ * impl, not redefined, traced, or taking an argument vector.
+ */
+static int is_builtin_form(obp_t sym, builtin_func_t *impl)
+{
+        obp_t fun = AS(sym, SYMBOL)->function;
+
+        return fun && IS_BUILTIN(fun) && !AS(fun, FUNCTION)->argv
+                && !AS(fun, FUNCTION)->trace
+                && AS(fun, FUNCTION)->impl.builtin == impl;
+}
+
+/**
+ * Return the lambda or bytecode function that a form headed by the symbol
+ * may call in tail position, or 0.
+ */
+static obp_t tail_function(obp_t sym)
+{
+        obp_t fun = AS(sym, SYMBOL)->function;
+
+        if (fun && (IS_FORM(fun) || IS_BYTECODE(fun))
+            && !AS(fun, FUNCTION)->is_special && !AS(fun, FUNCTION)->trace) {
+                return fun;
+        }
+        return 0;
+}
+
+static obp_t eval_tail(obp_t ob, session_context_t *sc, int level,
+                       tail_call_t *tail);
+
+/**
+ * Evaluate the forms of a list in sequence, the last one in tail position,
+ * and return the value of the last one, or nil if there is none.
+ */
+static obp_t progn_tail(obp_t forms, session_context_t *sc, int level,
+                        tail_call_t *tail)
+{
+        PROTECT;
+        PROTVAL(retval, the_Nil);
+
+        while (IS(forms, PAIR)) {
+                if (!IS(CDR(forms), PAIR)) {
+                        retval = eval_tail(CAR(forms), sc, level, tail);
+                        break;
+                }
+                retval = eval(CAR(forms), sc, level);
+                CHECK_ERROR(retval);
+                forms = CDR(forms);
+        }
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+/**
+ * Evaluate a form in tail position. The form is evaluated as eval() does,
+ * except that a call of a lambda or bytecode function, also as the taken
+ * branch of if, cond, or progn or as the expansion of a macro, is not made;
+ * instead, the function and the
+ * evaluated arguments are stored in *tail for apply() to call in place of the
+ * current function.
+ */
+static obp_t eval_tail(obp_t ob, session_context_t *sc, int level,
+                       tail_call_t *tail)
+{
+        PROTECT;
+        PROTVAR(retval);
+        PROTVAR(ev_args);                 /* evaluated arguments */
+        PROTVAR(last);                    /* last element of list */
+        obp_t head;
+        obp_t args;
+        obp_t fun;
+        int backtrace = 0;              /* print the form on an error */
+
+        if (traceflag || !IS(ob, PAIR) || !IS(CAR(ob), SYMBOL)) {
+                retval = eval(ob, sc, level);
+                goto EXIT;
+        }
+        head = CAR(ob);
+        args = CDR(ob);
+        backtrace = 1;
+        if ((fun = macro_of(ob))) {
+                eval_count++;
+                retval = eval_macro(ob, fun, sc, level + 1, tail);
+        } else if (is_builtin_form(head, bf_if) && IS(args, PAIR)) {
+                eval_count++;
+                retval = eval(CAR(args), sc, level + 1);
+                CHECK_ERROR(retval);
+                args = CDR(args);
+                if (retval != the_Nil) {
+                        retval = the_Nil;
+                        if (IS(args, PAIR)) {
+                                retval = eval_tail(CAR(args), sc, level + 1,
+                                                   tail);
+                        }
+                } else {
+                        retval = progn_tail(CDR(args), sc, level + 1, tail);
+                }
+        } else if (is_builtin_form(head, bf_cond)) {
+                for (obp_t cl = args; !IS_NIL(cl); cl = CDR(cl)) {
+                        if (!IS(cl, PAIR) || !IS(CAR(cl), PAIR)) {
+                                backtrace = 0;
+                                retval = eval(ob, sc, level);
+                                goto EXIT;
+                        }
+                }
+                eval_count++;
+                retval = the_Nil;
+                for ( ; !IS_NIL(args); args = CDR(args)) {
+                        obp_t clause = CAR(args);
+                        retval = eval(CAR(clause), sc, level + 1);
+                        CHECK_ERROR(retval);
+                        if (!IS_NIL(retval)) {
+                                if (!IS_NIL(CDR(clause))) {
+                                        retval = progn_tail(CDR(clause), sc,
+                                                            level + 1, tail);
+                                }
+                                break;
+                        }
+                }
+        } else if (is_builtin_form(head, bf_progn)) {
+                eval_count++;
+                retval = progn_tail(args, sc, level + 1, tail);
+        } else if ((fun = tail_function(head))) {
+                eval_count++;
+                for ( ; IS(args, PAIR); args = CDR(args)) {
+                        retval = eval(CAR(args), sc, level + 1);
+                        CHECK_ERROR(retval);
+                        if (ev_args == the_Nil) {
+                                ev_args = last = new_pair(retval, the_Nil);
+                        } else {
+                                obp_t p = new_pair(retval, the_Nil);
+                                CDR(last) = p;
+                                gc_write_barrier(last, p);
+                                last = p;
+                        }
+                }
+                tail->fun = fun;
+                tail->args = ev_args;
+                retval = the_Nil;
+        } else {
+                backtrace = 0;
+                retval = eval(ob, sc, level);
+        }
+    EXIT:
+        if (IS_EXIT(retval) && backtrace) {
+                port_printf(sc->out, "#%d: ", level);
+                print_expr(ob, sc->out);
+                terpri(sc->out);
+        }
+        UNPROTECT;
+        return retval;
+}
+
+
+/**
+ * Apply a function to the arguments. Lisp functions call a function in tail
+ * position of their body, also in the taken branch of if or cond, in a loop
+ * here instead of recursively, so tail-recursive functions do not grow the C
+ * stack. As the bindings of the called function replace those of the caller
+ * in place, the special binding stack does not grow either; they are all
+ * undone when apply() returns.
+ */
 obp_t apply(obp_t fun, obp_t args, session_context_t *sc, int level)
 {
         PROTECT;
         PROTVAR(retval);
-        PROTVAR(nargs);
+        PROTVAR(bound);
+        PROTVAL(saved_env, lexical_env);
+        tail_call_t tail = { 0, 0 };
+        uint depth = specpdl_top;
+
+        protect(fun);
+        protect(args);
+        protect(tail.fun);
+        protect(tail.args);
+        call_depth++;
+        if ((retval = check_depth(fun, sc))) {
+                goto EXIT;
+        }
+    again:
         apply_count++;
 
         /* We need not check for fun being a function, because we already have
@@ -172,23 +626,44 @@ obp_t apply(obp_t fun, obp_t args, session_context_t *sc, int level)
         assert(IS(fun, FUNCTION));
         if (IS_BUILTIN(fun)) {
                 retval = call_builtin(fun, args, sc, level);
-        } else if (IS_FORM(fun)) {
-                obp_t form = AS(fun, FUNCTION)->impl.form;
-                obp_t body = CDR(form); /* step over form */
-                obp_t params = CAR(body);  /* formal parameters */
-                nargs = make_bindings(params, args, sc, level);
-                CHECK_ERROR(nargs);
+        } else if (IS_FORM(fun) && AS(fun, FUNCTION)->lexical) {
+                retval = run_lexical(fun, args, depth, sc, level, &tail);
+                CHECK_ERROR(retval);
+        } else if (IS_FORM(fun) || IS_BYTECODE(fun)) {
+                obp_t body = CDR(AS(fun, FUNCTION)->impl.form);
+                bound = bind_lambda_list(fun, args, depth, sc, level);
+                CHECK_ERROR(bound);
                 
-                while (IS((body = CDR(body)), PAIR)) {
-                        retval = eval(CAR(body), sc, level);
-                        CHECK_ERROR(retval);
+                if (IS_BYTECODE(fun)) {
+                        retval = vm_run(fun, sc, level, &tail);
+                } else if (AS(fun, FUNCTION)->tree && !traceflag) {
+                        retval = run_analyzed(fun, sc, level, &tail);
+                } else {
+                        while (IS((body = CDR(body)), PAIR)) {
+                                if (!IS(CDR(body), PAIR)) {
+                                        retval = eval_tail(CAR(body), sc,
+                                                           level, &tail);
+                                } else {
+                                        retval = eval(CAR(body), sc, level);
+                                }
+                                CHECK_ERROR(retval);
+                        }
                 }
-                restore_bindings(params, (int) AS(nargs, NUMBER)->value,
-                                 sc, level);
         } else {
                 ERROR(sc->out, ERR_NOFUNC, fun, "not a valid function");
         }
+        if (tail.fun) {
+                fun = tail.fun;
+                args = tail.args;
+                tail.fun = tail.args = 0;
+                goto again;
+        }
     EXIT:
+        lexical_env = saved_env;
+        if (specpdl_top > depth) {
+                restore_bindings(depth, sc, level);
+        }
+        call_depth--;
         UNPROTECT;
         return retval;
 }
@@ -228,46 +703,173 @@ obp_t autoload(obp_t fun, session_context_t *sc, int level)
 }
 
 
-obp_t evalfun(obp_t func, obp_t args, session_context_t *sc, int level)
+/**
+ * Return the function object denoted by the car of a form: the function (or
+ * else the value) of a symbol, the function made of a lambda or mu form, or the
+ * value of another form. Autoload functions are loaded.
+ */
+static obp_t function_of(obp_t func, session_context_t *sc, int level)
 {
         PROTECT;
-        PROTVAR(retval);
-        PROTVAR(ev_args);                 /* evaluated arguments */
-        PROTVAR(last);                    /* last element of list */
-        PROTVAR(value);
-        
+        PROTVAL(retval, func);
+
         if (IS(func, PAIR)) {
                 if (!IS_LAMBDA(func) && !IS_MU(func)) {
-                        func = eval(func, sc, level);
-                        CHECK_ERROR(func);
+                        retval = eval(func, sc, level);
+                        CHECK_ERROR(retval);
                 }
         } else if (IS(func, SYMBOL)) {
-                obp_t sym = func;
-                func = AS(sym, SYMBOL)->function;
-                if (func == NULL) {
-                        func = AS(sym, SYMBOL)->value;
+                retval = AS(func, SYMBOL)->function;
+                if (retval == NULL) {
+                        retval = AS(func, SYMBOL)->value;
                 }
-                if (func == NULL) {
-                        ERROR(sc->out, ERR_NOFUNC, sym,
+                if (retval == NULL) {
+                        ERROR(sc->out, ERR_NOFUNC, func,
                               "symbol has no function definition");
                 }
         }
-        if (IS_AUTOLOAD(func)) {
-                func = autoload(func, sc, level);
-                CHECK_ERROR(func);
+        if (IS_AUTOLOAD(retval)) {
+                retval = autoload(retval, sc, level);
+                CHECK_ERROR(retval);
         }
         /* now we *should* have a function object of any kind  */
-        if (!IS(func, FUNCTION) && !IS_LAMBDA(func) && !IS_MU(func)) {
-                ERROR(sc->out, ERR_NOFUNC, func, "not a function object");
+        if (IS_LAMBDA(retval) || IS_MU(retval)) { /* may still be a constructed
+                                                     form! */
+                retval = form_function(retval, sc);
+                CHECK_ERROR(retval);
+        } else if (!IS(retval, FUNCTION)) {
+                ERROR(sc->out, ERR_NOFUNC, retval, "not a function object");
         }
-        if (IS_LAMBDA(func) || IS_MU(func)) { /* may still be a constructed form! */
-                func = make_function(0, 0, func, sc);
-                CHECK_ERROR(func);
-        } else if (!IS(func, FUNCTION)) {
-                ERROR(sc->out, ERR_NOFUNC, func, "not a function object");
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+/**
+ * Print a function call if the function is traced.
+ */
+static void trace_call(obp_t func, obp_t args, session_context_t *sc,
+                       int level)
+{
+        if (AS(func, FUNCTION)->trace) {
+                strbuf_t sb = strbuf_new();
+                sb = s_expr(func, sb, 0);
+                port_printf(sc->out, "%s(%s", blanks(level), strbuf_string(sb));
+                for (obp_t elem = args; IS(elem, PAIR); elem = CDR(elem)) {
+                        strbuf_reinit(sb);
+                        sb = s_expr(elem, sb, 0);
+                        port_printf(sc->out, " %s", strbuf_string(sb));
+                }
+                port_printf(sc->out, ")\n");
+                free(sb);
+        }
+}
+
+
+obp_t funcall_values(obp_t func, obp_t args, session_context_t *sc, int level)
+{
+        PROTECT;
+        PROTVAR(retval);
+
+        func = function_of(func, sc, level);
+        CHECK_ERROR(func);
+        protect(func);
+        trace_call(func, args, sc, level);
+        retval = apply(func, args, sc, level);
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+
+obp_t macro_of(obp_t form)
+{
+        if (IS(form, PAIR) && IS(CAR(form), SYMBOL)) {
+                obp_t fun = AS(CAR(form), SYMBOL)->function;
+                if (fun && IS_MACRO(fun)) {
+                        return fun;
+                }
+        }
+        return 0;
+}
+
+
+obp_t expand_macro(obp_t form, obp_t macro, session_context_t *sc, int level)
+{
+        uint slot = (uintptr_t) form / OBSIZE_UNIT % MACRO_CACHE_SIZE;
+        macro_expansion_t *cached = &macro_cache[slot];
+
+        if (cached->form == form && cached->macro == macro) {
+                return cached->expansion;
+        }
+        PROTECT;
+        PROTVAR(retval);
+        protect(form);
+        protect(macro);
+        trace_call(macro, CDR(form), sc, level);
+        retval = apply(macro, CDR(form), sc, level);
+        CHECK_ERROR(retval);
+        cached->form = form;
+        cached->macro = macro;
+        cached->expansion = retval;
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+
+obp_t eval_macro(obp_t form, obp_t macro, session_context_t *sc, int level,
+                 tail_call_t *tail)
+{
+        PROTECT;
+        PROTVAR(retval);
+
+        retval = expand_macro(form, macro, sc, level);
+        CHECK_ERROR(retval);
+        if (tail) {
+                retval = eval_tail(retval, sc, level, tail);
+        } else {
+                retval = eval(retval, sc, level);
         }
+    EXIT:
+        UNPROTECT;
+        return retval;
+}
+
+
+obp_t evalfun(obp_t func, obp_t args, session_context_t *sc, int level)
+{
+        PROTECT;
+        PROTVAR(retval);
+        PROTVAR(ev_args);                 /* evaluated arguments */
+        PROTVAR(last);                    /* last element of list */
+        PROTVAR(value);
+        uint base = value_stack_top;
+        
+        func = function_of(func, sc, level);
+        CHECK_ERROR(func);
+        protect(func);
         /* now we *have* a function object of any kind  */
         
+        if (IS_BUILTIN(func) && AS(func, FUNCTION)->argv
+            && !AS(func, FUNCTION)->trace) {
+                /* evaluate the arguments onto the value stack */
+                int argc = 0;
+                for (obp_t elem = args; IS(elem, PAIR); elem = CDR(elem)) {
+                        argc++;
+                }
+                reserve_values(argc);
+                for (int i = 0; i < argc; i++) {
+                        value = eval(CAR(args), sc, level);
+                        CHECK_ERROR(value);
+                        value_stack[base + i] = value;
+                        args = CDR(args);
+                }
+                apply_count++;
+                retval = call_builtin_argv(func, argc, value_stack + base, sc,
+                                           level);
+                goto EXIT;
+        }
         if (!IS_SPECIAL(func)) {
                 /* must evaluate arguments */
                 for (obp_t elem = args; IS(elem, PAIR); elem = CDR(elem)) {
@@ -278,25 +880,21 @@ obp_t evalfun(obp_t func, obp_t args, session_context_t *sc, int level)
                         } else {
                                 obp_t p = new_pair(value, the_Nil);
                                 CDR(last) = p;
+                                gc_write_barrier(last, p);
                                 last = p;
                         }
                 }
                 args = ev_args;
         }
-        if (AS(func, FUNCTION)->trace) {
-                strbuf_t sb = strbuf_new();
-                sb = s_expr(func, sb, 0);
-                port_printf(sc->out, "%s(%s", blanks(level), strbuf_string(sb));
-                for (obp_t elem = ev_args; IS(elem, PAIR); elem = CDR(elem)) {
-                        strbuf_reinit(sb);
-                        sb = s_expr(elem, sb, 0);
-                        port_printf(sc->out, " %s", strbuf_string(sb));
-                }
-                port_printf(sc->out, ")\n");
-                free(sb);
-        }
+        trace_call(func, ev_args, sc, level);
         retval = apply(func, args, sc, level);
+        if (IS_MACRO(func)) {
+                /* not called by a symbol, so not cached */
+                CHECK_ERROR(retval);
+                retval = eval(retval, sc, level);
+        }
     EXIT:
+        value_stack_top = base;
         UNPROTECT;
         return retval;
 }
@@ -307,12 +905,16 @@ obp_t eval(obp_t ob, session_context_t *sc, int level)
         PROTECT;
         PROTVAR(retval);
         Lpair_t *pair;
+        obp_t macro;
 
         eval_count++;
+        if (stack_exhausted()) {
+                ERROR(sc->out, ERR_DEPTH, ob, "C stack exhausted");
+        }
         if (traceflag) {
                 port_printf(sc->out, "%seval[%d]", blanks(level), level);
         }
-        switch (ob->type) {
+        switch (type_of(ob)) {
             case SYMBOL:
                 retval = AS(ob, SYMBOL)->value;
                 if (!retval) {
@@ -333,7 +935,11 @@ obp_t eval(obp_t ob, session_context_t *sc, int level)
                         print_expr(ob, sc->out);
                         terpri(sc->out);
                 }
-                retval = evalfun(pair->car, pair->cdr, sc, level + 1);
+                if ((macro = macro_of(ob))) {
+                        retval = eval_macro(ob, macro, sc, level + 1, 0);
+                } else {
+                        retval = evalfun(pair->car, pair->cdr, sc, level + 1);
+                }
                 break;
             default:
                 if (traceflag) {
@@ -8,17 +8,142 @@
 extern long eval_count;
 extern long apply_count;
 extern long bind_count;
+extern ulong function_epoch;
+extern uint call_depth;                 /* nesting depth of function calls */
+extern uint max_depth;                  /* maximum of call_depth */
+
+/* The functions last made from lambda and mu forms at the head of a call,
+ * indexed by a hash of the form's address; the GC scans them.
+ */
+extern obp_t lambda_cache[LAMBDA_CACHE_SIZE];
+
+/* An expansion of a macro call, valid as long as the form calls the same
+ * macro.
+ */
+typedef struct MACRO_EXPANSION {
+        obp_t form;                     /* the call, or 0 */
+        obp_t macro;                    /* the macro it called */
+        obp_t expansion;
+} macro_expansion_t;
+
+/* The expansions last made of macro calls, indexed by a hash of the form's
+ * address; the GC scans them.
+ */
+extern macro_expansion_t macro_cache[MACRO_CACHE_SIZE];
+
+/* The value stack holds the arguments of builtins taking an argument vector
+ * and the values of running bytecode functions; the GC scans it up to its top.
+ * It is moved when it grows, so pointers into it become invalid when Lisp code
+ * is evaluated.
+ */
+extern obp_t *value_stack;
+extern uint value_stack_top;
+
+/**
+ * Reserve n entries on the value stack, set to nil, and return the index of
+ * the first; they are released by setting value_stack_top back to it.
+ */
+uint reserve_values(uint n);
+
+/* A call in tail position of a function body, left for apply() to make in
+ * place of the current call; fun is 0 if there is none.
+ */
+typedef struct TAIL_CALL {
+        obp_t fun;                      /* lambda or bytecode function */
+        obp_t args;                     /* the evaluated arguments */
+} tail_call_t;
+
+/**
+ * Initialize the evaluator; must be called early in main().
+ */
+void init_eval(void);
+
+/**
+ * Return an error if a call would nest deeper than max_depth, or if the C
+ * stack is nearly exhausted; otherwise return 0.
+ */
+obp_t check_depth(obp_t fun, session_context_t *sc);
 
-// obp_t evalfun(obp_t fun, obp_t args);
 obp_t eval(obp_t ob, session_context_t *sc, int level);
 
+/**
+ * Evaluate a form with the specified car and cdr, as eval() does for a pair.
+ */
+obp_t evalfun(obp_t func, obp_t args, session_context_t *sc, int level);
+
 obp_t apply(obp_t fun, obp_t args, session_context_t *sc, int level);
 
+/**
+ * Call the function denoted by func, as the car of a form would, with the
+ * already evaluated arguments.
+ */
+obp_t funcall_values(obp_t func, obp_t args, session_context_t *sc, int level);
+
+/**
+ * Return the macro a form calls by the symbol at its head, or 0.
+ */
+obp_t macro_of(obp_t form);
+
+/**
+ * Return the expansion of a call of a macro, made by applying the macro to the
+ * unevaluated arguments. The expansion is cached for the form, so a macro
+ * should compute the same expansion each time for the same form.
+ */
+obp_t expand_macro(obp_t form, obp_t macro, session_context_t *sc, int level);
+
+/**
+ * Evaluate a call of a macro by evaluating its expansion, in tail position if
+ * tail is not 0 (see apply()).
+ */
+obp_t eval_macro(obp_t form, obp_t macro, session_context_t *sc, int level,
+                 tail_call_t *tail);
+
 
 obp_t make_bindings(obp_t params, obp_t args, session_context_t *sc, int level);
-void restore_bindings(obp_t params, int nargs, session_context_t *sc, int level);
+
+/**
+ * Like make_bindings(), but reuse the bindings made from index merge_from of
+ * the special binding stack on for parameters bound there already.
+ */
+obp_t bind_params(obp_t params, obp_t args, uint merge_from,
+                  session_context_t *sc, int level);
+
+/**
+ * Bind the parameters of a lambda or bytecode function to the arguments, by
+ * its lambda list, as bind_params() does; the default value forms of optional
+ * parameters without an argument are evaluated after binding the parameters
+ * before them.
+ */
+obp_t bind_lambda_list(obp_t fun, obp_t args, uint merge_from,
+                       session_context_t *sc, int level);
+
+/**
+ * Bind a parameter symbol to its argument. If the symbol is already bound in
+ * the special binding stack from index merge_from on, that binding is reused.
+ */
+void bind_param(obp_t param, obp_t arg, uint merge_from);
+void restore_bindings(uint depth, session_context_t *sc, int level);
+
+/**
+ * Check a lambda or mu form and compute its minimum and maximum number of
+ * arguments. Return 0 if it is a proper function, or else a description of
+ * what is wrong.
+ */
+char *check_form(obp_t func, short *minargs, short *maxargs);
+
+/**
+ * Return the parsed lambda list of a lambda or mu form that has passed
+ * check_form(); free it with xfree().
+ */
+lambda_list_t *new_lambda_list(obp_t arglist);
 
 /**
  * return NULL if argument is a proper function
  */
 obp_t make_function(char *name, uint namelen, obp_t func, session_context_t *sc);
+
+/**
+ * Set the function of a symbol. This increments function_epoch, which
+ * invalidates the function lookups cached by analyzed function bodies.
+ */
+void set_function(obp_t sym, obp_t func);
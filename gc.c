@@ -4,19 +4,29 @@
 
 #include "cbasics.h"
 #include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
 #include "objects.h"
 #include "xmemory.h"
 #include "gc.h"
+#include "heap.h"
+#include "memlimit.h"
 #include "printer.h"
+#include "eval.h"
+#include "bytecode.h"
+#include "analyze.h"
 
-gcp_t gc_prot_root;
+obp_t **gc_roots;                       /* addresses of protected variables */
+uint gc_roots_top;                      /* index of the next free slot */
+uint gc_roots_size;                     /* number of allocated slots */
 
-gcp_t gc_start_protect(char *file, int line)
+uint gc_start_protect(char *file, int line)
 {
         if (traceflag) {
-                printf("PROTECT %s:%d:%p\n", file, line, gc_prot_root);
+                printf("PROTECT %s:%d:%u\n", file, line, gc_roots_top);
         }
-        return gc_prot_root;
+        return gc_roots_top;
 }
 
 void gc_protect(char *what, int line, obp_t *obpp)
@@ -24,87 +34,721 @@ void gc_protect(char *what, int line, obp_t *obpp)
         if (traceflag) {
                 printf("protect %s:%d:%p\n", what, line, obpp);
         }
-        gcp_t newp = (gcp_t) new_object(sizeof(struct GCPROT), GCPROT);
-        newp->item.obpp = obpp;
-        newp->next = gc_prot_root;
-        newp->is_obpp = 1;
-        gc_prot_root = newp;
+        if (gc_roots_top >= gc_roots_size) {
+                gc_roots_size = gc_roots_size ? 2 * gc_roots_size
+                                              : GC_ROOTS_INITIAL;
+                gc_roots = xrealloc(gc_roots, gc_roots_size * sizeof(obp_t *),
+                                    "GC root stack");
+        }
+        gc_roots[gc_roots_top++] = obpp;
 }
 
 
-void gc_unprotect(gcp_t prot_state, char *file, int line)
+void gc_unprotect(uint prot_state, char *file, int line)
 {
-        gc_prot_root = prot_state;
+        gc_roots_top = prot_state;
         if (traceflag) {
-                printf("UNPROTECT %s:%d:%p\n", file, line, gc_prot_root);
+                printf("UNPROTECT %s:%d:%u\n", file, line, gc_roots_top);
         }
 }
 
+int gc_incremental;                     /* mark in slices between allocations */
+uint gc_slice_work = GC_SLICE_WORK;     /* objects to scan per slice */
+uint gc_slice_usecs;                    /* time budget per slice, if non-zero */
+int gc_marking;                         /* an incremental cycle is marking */
+
+uint gc_threads = GC_THREADS;           /* number of marking threads */
+double gc_growth = GC_GROWTH;           /* target heap growth factor */
+ulong gc_alloc_bytes;                   /* allocated since the last cycle */
+ulong gc_trigger_bytes = GC_MIN_BYTES;  /* allocation that starts a cycle */
+
 uint marked;
+ulong marked_bytes;
 uint freed;
 uint alloced;
 uint visited;
 
-void gc_mark(obp_t ob)
+obp_t *mark_stack;                      /* marked objects yet to be scanned */
+uint mark_stack_top;                    /* index of the next free entry */
+uint mark_stack_size;                   /* number of allocated entries */
+
+
+/* For parallel marking, each marking thread has a Chase-Lev work-stealing
+ * deque of objects yet to be scanned: the owner pushes and takes at the
+ * bottom, other threads steal at the top. Mark bits are then set atomically.
+ * The serial marker, used otherwise, is represented by a null marker_t
+ * pointer and uses the mark stack above.
+ */
+typedef struct DEQUE_ARRAY {
+        long size;                      /* number of slots, a power of two */
+        struct DEQUE_ARRAY *prev;       /* array replaced by this one, to be
+                                           freed after marking */
+        obp_t buf[];
+} deque_array_t;
+
+typedef struct MARKER {
+        long top;                       /* stealing end of the deque */
+        long bottom;                    /* owner's end of the deque */
+        deque_array_t *array;           /* the deque's slots */
+        uint marked;                    /* objects marked by this thread */
+        ulong marked_bytes;             /* and their size */
+        uint seed;                      /* for choosing victims to steal from */
+} __attribute__((aligned(64))) marker_t;
+
+#define STEAL_ABORT ((obp_t) 1)         /* lost a race, try again */
+
+static deque_array_t *new_deque_array(long size, deque_array_t *prev)
+{
+        deque_array_t *a = xmalloc(sizeof(deque_array_t) + size * sizeof(obp_t),
+                                   "GC mark deque");
+        a->size = size;
+        a->prev = prev;
+        return a;
+}
+
+static void deque_push(marker_t *m, obp_t ob)
+{
+        long b = __atomic_load_n(&m->bottom, __ATOMIC_RELAXED);
+        long t = __atomic_load_n(&m->top, __ATOMIC_ACQUIRE);
+        deque_array_t *a = __atomic_load_n(&m->array, __ATOMIC_RELAXED);
+
+        if (b - t > a->size - 1) {
+                deque_array_t *new = new_deque_array(2 * a->size, a);
+                for (long i = t; i < b; i++) {
+                        new->buf[i & (new->size - 1)]
+                                = a->buf[i & (a->size - 1)];
+                }
+                __atomic_store_n(&m->array, new, __ATOMIC_RELEASE);
+                a = new;
+        }
+        __atomic_store_n(&a->buf[b & (a->size - 1)], ob, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&m->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+static obp_t deque_take(marker_t *m)
+{
+        long b = __atomic_load_n(&m->bottom, __ATOMIC_RELAXED) - 1;
+        deque_array_t *a = __atomic_load_n(&m->array, __ATOMIC_RELAXED);
+        __atomic_store_n(&m->bottom, b, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        long t = __atomic_load_n(&m->top, __ATOMIC_RELAXED);
+        obp_t ob = 0;
+
+        if (t <= b) {
+                ob = __atomic_load_n(&a->buf[b & (a->size - 1)],
+                                     __ATOMIC_RELAXED);
+                if (t == b) {
+                        /* the last one; race against thieves */
+                        if (!__atomic_compare_exchange_n(&m->top, &t, t + 1, 0,
+                                                         __ATOMIC_SEQ_CST,
+                                                         __ATOMIC_RELAXED)) {
+                                ob = 0;
+                        }
+                        __atomic_store_n(&m->bottom, b + 1, __ATOMIC_RELAXED);
+                }
+        } else {
+                __atomic_store_n(&m->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+        return ob;
+}
+
+static obp_t deque_steal(marker_t *m)
 {
-        ob->mark = 1;
+        long t = __atomic_load_n(&m->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        long b = __atomic_load_n(&m->bottom, __ATOMIC_ACQUIRE);
+
+        if (t >= b) {
+                return 0;
+        }
+        deque_array_t *a = __atomic_load_n(&m->array, __ATOMIC_ACQUIRE);
+        obp_t ob = __atomic_load_n(&a->buf[t & (a->size - 1)],
+                                   __ATOMIC_RELAXED);
+        if (!__atomic_compare_exchange_n(&m->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                return STEAL_ABORT;
+        }
+        return ob;
+}
+
+
+/**
+ * Mark an object unless it is already marked; return non-zero iff it was
+ * marked now.
+ */
+static int mark_ob(obp_t ob, marker_t *m)
+{
+        if (m) {
+                if (!heap_test_and_mark(ob)) {
+                        return 0;
+                }
+                m->marked++;
+                m->marked_bytes += OB_SIZE(ob);
+                return 1;
+        }
+        if (heap_marked(ob)) {
+                return 0;
+        }
+        heap_set_mark(ob);
         marked++;
+        marked_bytes += OB_SIZE(ob);
+        return 1;
+}
+
+/**
+ * Mark an object and push it onto the mark stack (or the marker's deque) to
+ * have its references scanned, unless it is already marked. The object is
+ * prefetched, as it will be needed when it is popped again.
+ */
+static void mark_push(obp_t ob, marker_t *m)
+{
+        if (ob == 0 || IS_IMMEDIATE(ob) || !mark_ob(ob, m)) {
+                return;
+        }
+        __builtin_prefetch(ob);
+        if (m) {
+                deque_push(m, ob);
+                return;
+        }
+        if (mark_stack_top >= mark_stack_size) {
+                mark_stack_size = mark_stack_size ? 2 * mark_stack_size
+                                                  : MARK_STACK_INITIAL;
+                mark_stack = xrealloc(mark_stack,
+                                      mark_stack_size * sizeof(obp_t),
+                                      "GC mark stack");
+        }
+        mark_stack[mark_stack_top++] = ob;
+}
+
+static void mark_map_entry(obp_t key, obp_t value, void *arg)
+{
+        mark_push(key, arg);
+        mark_push(value, arg);
+}
+
+/**
+ * Push the objects referenced by an object onto the mark stack. This is the
+ * GC's own version of traverse_ob(), which recurses once per reference.
+ */
+static void scan_ob(obp_t ob, marker_t *m)
+{
+        switch (ob->type) {
+            case PAIR:
+                /* Follow the cdr chain in place, so a list takes only one
+                 * stack entry per car, not one per cons.
+                 */
+                for (;;) {
+                        obp_t next = CDR(ob);
+                        __builtin_prefetch(next);
+                        mark_push(CAR(ob), m);
+                        if (next == 0 || !IS(next, PAIR)) {
+                                mark_push(next, m);
+                                break;
+                        }
+                        if (!mark_ob(next, m)) {
+                                break;
+                        }
+                        ob = next;
+                }
+                break;
+            case SYMBOL: {
+                Lsymbol_t *sym = AS(ob, SYMBOL);
+                mark_push(sym->name, m);
+                mark_push(sym->value, m);
+                mark_push(sym->function, m);
+                mark_push(sym->props, m);
+                break;
+            }
+            case MAP:
+                hashmap_walk(AS(ob, MAP)->map, mark_map_entry, m);
+                break;
+            case VECTOR: {
+                Lvector_t *vec = AS(ob, VECTOR);
+                for (uint i = 0; i < vec->nelem; i++) {
+                        mark_push(vec->elem[i], m);
+                }
+                break;
+            }
+            case SIGNAL:
+                mark_push(AS(ob, SIGNAL)->data, m);
+                mark_push(AS(ob, SIGNAL)->message, m);
+                break;
+            case FUNCTION: {
+                Lfunction_t *func = AS(ob, FUNCTION);
+                if (func->type == F_AUTOLOAD) {
+                        mark_push(func->impl.filename, m);
+                } else if (func->type == F_FORM
+                           || func->type == F_BYTECODE) {
+                        mark_push(func->impl.form, m);
+                }
+                mark_push(func->code, m);
+                mark_push(func->env, m);
+                break;
+            }
+            case ENVIRON: {
+                Lenviron_t *env = AS(ob, ENVIRON);
+                mark_push(env->parent, m);
+                for (uint i = 0; i < env->nslots; i++) {
+                        mark_push(env->slot[i], m);
+                }
+                break;
+            }
+            default:                    /* no references */
+                break;
+        }
+}
+
+/**
+ * Scan the objects on the mark stack until it is empty.
+ */
+static void mark_loop(void)
+{
+        while (mark_stack_top) {
+                scan_ob(mark_stack[--mark_stack_top], 0);
+        }
+}
+
+
+static marker_t *markers;               /* one per marking thread */
+static uint idle_markers;               /* threads that found no work */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static uint pool_epoch;                 /* counts parallel mark phases */
+static uint pool_finished;              /* helper threads done with a phase */
+
+/**
+ * Try to steal an object from the other markers' deques, beginning with a
+ * random one.
+ */
+static obp_t steal_work(marker_t *m)
+{
+        uint start = (m->seed = m->seed * 1103515245 + 12345) % gc_threads;
+
+        for (uint i = 0; i < gc_threads; i++) {
+                marker_t *victim = &markers[(start + i) % gc_threads];
+                if (victim == m) {
+                        continue;
+                }
+                obp_t ob;
+                while ((ob = deque_steal(victim)) == STEAL_ABORT) {
+                        ;
+                }
+                if (ob) {
+                        return ob;
+                }
+        }
+        return 0;
+}
+
+/**
+ * Return non-zero iff any marker's deque seems to have work.
+ */
+static int work_available(void)
+{
+        for (uint i = 0; i < gc_threads; i++) {
+                if (__atomic_load_n(&markers[i].top, __ATOMIC_ACQUIRE)
+                    < __atomic_load_n(&markers[i].bottom, __ATOMIC_ACQUIRE)) {
+                        return 1;
+                }
+        }
+        return 0;
 }
 
-int gc_stop_traverse(obp_t ob)
+/**
+ * The mark loop of a marking thread: scan objects from its own deque, steal
+ * from the others when it runs empty, and return when all threads are out of
+ * work. A thread counts as idle only while it has no object in hand, so all
+ * threads being idle means all deques are empty.
+ */
+static void parallel_mark(marker_t *m)
 {
-        return ob == 0 || ob->mark;
+        obp_t ob;
+
+        for (;;) {
+                while ((ob = deque_take(m))) {
+                        scan_ob(ob, m);
+                }
+                if ((ob = steal_work(m))) {
+                        scan_ob(ob, m);
+                        continue;
+                }
+                __atomic_add_fetch(&idle_markers, 1, __ATOMIC_SEQ_CST);
+                for (;;) {
+                        if (__atomic_load_n(&idle_markers, __ATOMIC_SEQ_CST)
+                            == gc_threads) {
+                                return;
+                        }
+                        if (work_available()) {
+                                __atomic_sub_fetch(&idle_markers, 1,
+                                                   __ATOMIC_SEQ_CST);
+                                break;
+                        }
+                        sched_yield();
+                }
+        }
 }
 
+static void *marker_thread(void *arg)
+{
+        marker_t *m = arg;
+        uint epoch = 0;
+
+        for (;;) {
+                pthread_mutex_lock(&pool_lock);
+                while (pool_epoch == epoch) {
+                        pthread_cond_wait(&pool_start, &pool_lock);
+                }
+                epoch = pool_epoch;
+                pthread_mutex_unlock(&pool_lock);
+
+                parallel_mark(m);
 
-obp_t sweep_runner(obp_t obs, obp_t result)
+                pthread_mutex_lock(&pool_lock);
+                pool_finished++;
+                pthread_cond_signal(&pool_done);
+                pthread_mutex_unlock(&pool_lock);
+        }
+        return 0;
+}
+
+/**
+ * Start the marking threads; the calling thread is marker number 0.
+ */
+static void start_markers(void)
+{
+        markers = xcalloc(gc_threads, sizeof(marker_t), "GC markers");
+        for (uint i = 0; i < gc_threads; i++) {
+                markers[i].array = new_deque_array(MARK_STACK_INITIAL, 0);
+                markers[i].seed = i;
+        }
+        for (uint i = 1; i < gc_threads; i++) {
+                pthread_t thread;
+                if (pthread_create(&thread, 0, marker_thread, &markers[i])) {
+                        fprintf(stderr, "PANIC! cannot create GC thread\n");
+                        exit(1);
+                }
+                pthread_detach(thread);
+        }
+}
+
+/**
+ * Mark everything reachable from the objects on the mark stack, distributing
+ * them over the marking threads.
+ */
+static void mark_parallel(void)
 {
-        if (obs == 0) {
-                return result;
+        if (markers == 0) {
+                start_markers();
         }
+        for (uint i = 0; i < mark_stack_top; i++) {
+                deque_push(&markers[i % gc_threads], mark_stack[i]);
+        }
+        mark_stack_top = 0;
+
+        pthread_mutex_lock(&pool_lock);
+        idle_markers = 0;
+        pool_finished = 0;
+        pool_epoch++;
+        pthread_cond_broadcast(&pool_start);
+        pthread_mutex_unlock(&pool_lock);
 
-        visited++;
-        obp_t first = obs;
-        obp_t rest = obs->next;
-        
-        if (first->mark) {
-                first->mark = 0;
-                first->next = result;
-                return sweep_runner(rest, first);
+        parallel_mark(&markers[0]);
+
+        pthread_mutex_lock(&pool_lock);
+        while (pool_finished < gc_threads - 1) {
+                pthread_cond_wait(&pool_done, &pool_lock);
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        for (uint i = 0; i < gc_threads; i++) {
+                marker_t *m = &markers[i];
+                deque_array_t *a = m->array->prev;
+                while (a) {
+                        deque_array_t *prev = a->prev;
+                        xfree(a);
+                        a = prev;
+                }
+                m->array->prev = 0;
+                marked += m->marked;
+                marked_bytes += m->marked_bytes;
+                m->marked = 0;
+                m->marked_bytes = 0;
+        }
+}
+
+/**
+ * Return the current time in microseconds.
+ */
+static ulong now_usecs(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Scan objects from the mark stack until it is empty or the budget of a slice
+ * is used up, whichever comes first. Return non-zero iff the stack is empty.
+ */
+static int mark_slice(void)
+{
+        ulong deadline = gc_slice_usecs ? now_usecs() + gc_slice_usecs : 0;
+        uint work = 0;
+
+        while (mark_stack_top) {
+                scan_ob(mark_stack[--mark_stack_top], 0);
+                if (++work >= gc_slice_work) {
+                        break;
+                }
+                if (deadline && work % 64 == 0 && now_usecs() >= deadline) {
+                        break;
+                }
+        }
+        return mark_stack_top == 0;
+}
+
+
+/* The generational scheme uses sticky mark bits: objects that have survived a
+ * collection keep their mark and are the old generation; unmarked objects are
+ * the young generation. A minor collection marks from the roots and the
+ * remembered set, stops at marked objects, and sweeps only young ones. A major
+ * collection clears all marks first and so collects both generations.
+ *
+ * The remembered set holds the old objects a reference to a young object has
+ * been stored into since the last collection; gc_write_barrier() adds them.
+ */
+obp_t *remembered;                      /* the remembered set */
+uint remembered_top;                    /* index of the next free entry */
+uint remembered_size;                   /* number of allocated entries */
+
+uint old_objects;                       /* survivors of the last GC */
+ulong old_bytes;                        /* and their size */
+uint old_after_major;                   /* survivors of the last major GC */
+
+/* In incremental mode, marking is done in slices between allocations. During
+ * marking, the write barrier shades the stored object instead (Dijkstra), so
+ * no marked object ever references an unmarked one without it being on the
+ * mark stack. Objects allocated while marking are unmarked; if they are still
+ * reachable, they are found through the roots, which are scanned again in the
+ * final, atomic slice, or through the barrier.
+ */
+/* With a memory limit, collections are also scheduled to keep the resident set
+ * below gc_mem_fraction of the limit. While it is below half of that budget,
+ * the growth policy applies unchanged. Beyond, the next cycle is a major one
+ * and is due after at most half of the remaining headroom, and the sweep is
+ * finished right away so the empty pages can be given back to the OS.
+ */
+double gc_mem_fraction;                 /* of the limit to stay below; 0: off */
+ulong gc_mem_limit;                     /* the memory limit in bytes */
+static int mem_pressure;                /* above half of the budget */
+
+static int cycle_major;                 /* the current cycle is a major one */
+static uint slice_countdown;            /* allocations until the next slice */
+
+/**
+ * Put an object into the remembered set.
+ */
+static void remember(obp_t ob)
+{
+        heap_page_t *page = HEAP_PAGE_OF(ob);
+        uint slot = HEAP_SLOT(page, ob);
+        ulong bit = 1UL << (slot % 64);
+
+        if (page->remembered[slot / 64] & bit) {
+                return;
+        }
+        page->remembered[slot / 64] |= bit;
+        if (remembered_top >= remembered_size) {
+                remembered_size = remembered_size ? 2 * remembered_size
+                                                  : MARK_STACK_INITIAL;
+                remembered = xrealloc(remembered,
+                                      remembered_size * sizeof(obp_t),
+                                      "GC remembered set");
+        }
+        remembered[remembered_top++] = ob;
+}
+
+/**
+ * Empty the remembered set, scanning its objects first if so requested.
+ */
+static void flush_remembered(int scan)
+{
+        for (uint i = 0; i < remembered_top; i++) {
+                obp_t ob = remembered[i];
+                heap_page_t *page = HEAP_PAGE_OF(ob);
+                uint slot = HEAP_SLOT(page, ob);
+                page->remembered[slot / 64] &= ~(1UL << (slot % 64));
+                if (scan) {
+                        scan_ob(ob, 0);
+                }
+        }
+        remembered_top = 0;
+}
+
+
+void gc_write_barrier_slow(obp_t ob, obp_t val)
+{
+        if (gc_marking) {
+                mark_push(val, 0);
         } else {
-                ob_free(first);
-                freed++;
-                return sweep_runner(rest, result);
+                remember(ob);
         }
 }
 
 
-void gc_sweep(void)
+/**
+ * Push the roots onto the mark stack: the GC root stack, the special binding
+ * stack, the VM frames, the value stack, the lambda and macro caches, the
+ * current frame of lexical variables, and the symbols.
+ */
+static void mark_roots(void)
 {
-        alloced_obs = sweep_runner(alloced_obs, 0);
-        obp_t foo = alloced_obs;
-        while (foo) {
-                alloced++;
-                foo = foo->next;
+        for (uint i = 0; i < gc_roots_top; i++) {
+                mark_push(*gc_roots[i], 0);
+        }
+        for (uint i = 0; i < specpdl_top; i++) {
+                mark_push(specpdl[i].symbol, 0);
+                mark_push(specpdl[i].old_value, 0);
+        }
+        for (uint i = 0; i < vm_frames_top; i++) {
+                mark_push(vm_frames[i].fun, 0);
+        }
+        for (uint i = 0; i < value_stack_top; i++) {
+                mark_push(value_stack[i], 0);
         }
+        for (uint i = 0; i < LAMBDA_CACHE_SIZE; i++) {
+                mark_push(lambda_cache[i], 0);
+        }
+        for (uint i = 0; i < MACRO_CACHE_SIZE; i++) {
+                mark_push(macro_cache[i].form, 0);
+                mark_push(macro_cache[i].macro, 0);
+                mark_push(macro_cache[i].expansion, 0);
+        }
+        mark_push(lexical_env, 0);
+        mark_push(symbols, 0);
 }
 
-void gc(void)
+/**
+ * Check the resident set against the memory limit after a cycle and, if it is
+ * getting close, collect sooner and release memory. Finishing the sweep
+ * early for that records its counts, which cover the whole sweep.
+ */
+static void schedule_for_limit(void)
+{
+        ulong budget = gc_mem_limit * gc_mem_fraction;
+        ulong rss = memlimit_rss();
+
+        mem_pressure = rss > budget / 2;
+        if (!mem_pressure) {
+                return;
+        }
+        heap_finish_sweep(&visited, &freed);
+        heap_release_empty();
+        rss = memlimit_rss();
+        ulong headroom = rss < budget ? budget - rss : 0;
+        if (gc_trigger_bytes > headroom / 2) {
+                gc_trigger_bytes = MAX(headroom / 2, GC_MIN_BYTES);
+        }
+}
+
+/**
+ * Start a major or minor collection cycle.
+ */
+static void start_cycle(int major)
 {
+        heap_finish_sweep(&visited, &freed);
         marked = 0;
-        freed = 0;
-        alloced = 0;
-        visited = 0;
-        fprintf(stderr, "[GC");
-        traverse_ob((obp_t) gc_prot_root, gc_mark, gc_stop_traverse);
-        fprintf(stderr, ".");
-        traverse_ob((obp_t) pushdown_list, gc_mark, gc_stop_traverse);
-        fprintf(stderr, ".");
-        traverse_ob(symbols, gc_mark, gc_stop_traverse);
-        fprintf(stderr, ".");
-        gc_sweep();
-        fprintf(stderr, " %u marked, %u freed, %u alloced, %u visited]\n",
-                marked, freed, alloced, visited);
+        marked_bytes = 0;
+        cycle_major = major;
+        if (major) {
+                heap_clear_marks();
+        }
+        flush_remembered(!major);
+        mark_roots();
+}
+
+/**
+ * Finish a collection cycle: scan the roots again, mark everything that is
+ * left, and start the (lazy) sweep. As marks are sticky, the surviving objects
+ * are those marked now plus, in a minor collection, the old ones; their size
+ * determines when the next cycle is due. The numbers of objects freed and
+ * visited are those of the previous cycle's sweep, which has been finished
+ * only when this cycle started.
+ */
+static void finish_cycle(void)
+{
+        mark_roots();
+        mark_loop();
+        gc_marking = 0;
+        heap_sweep();
+        alloced = cycle_major ? marked : old_objects + marked;
+        old_objects = alloced;
+        old_bytes = cycle_major ? marked_bytes : old_bytes + marked_bytes;
+        gc_alloc_bytes = 0;
+        gc_trigger_bytes = old_bytes * (gc_growth - 1);
+        if (gc_trigger_bytes < GC_MIN_BYTES) {
+                gc_trigger_bytes = GC_MIN_BYTES;
+        }
+        if (gc_mem_fraction) {
+                schedule_for_limit();
+        }
+        if (cycle_major) {
+                old_after_major = alloced;
+        }
+        fprintf(stderr, "[GC%s... %u marked, %u alloced; last sweep %u freed, "
+                "%u visited]\n", cycle_major ? "" : " minor",
+                marked, alloced, freed, visited);
+}
+
+/**
+ * Do a major or minor collection all at once.
+ */
+static void collect(int major)
+{
+        start_cycle(major);
+        if (gc_threads > 1) {
+                mark_parallel();
+        } else {
+                mark_loop();
+        }
+        finish_cycle();
+}
+
+void gc_full(void)
+{
+        if (gc_marking) {
+                finish_cycle();
+        }
+        collect(1);
+}
+
+void gc(void)
+{
+        int major = old_after_major == 0 || mem_pressure
+                || old_objects > GC_MAJOR_FACTOR * old_after_major;
+
+        if (gc_marking) {
+                finish_cycle();
+        } else if (gc_incremental) {
+                start_cycle(major);
+                gc_marking = 1;
+                slice_countdown = GC_SLICE_INTERVAL;
+        } else {
+                collect(major);
+        }
+}
+
+void gc_step(void)
+{
+        if (--slice_countdown) {
+                return;
+        }
+        slice_countdown = GC_SLICE_INTERVAL;
+        if (mark_slice()) {
+                finish_cycle();
+        }
 }
 
 
@@ -6,19 +6,71 @@
 #define __GC_H_INC
 
 #include "cbasics.h"
+#include "heap.h"
+#include "objects.h"
 
-gcp_t gc_start_protect(char *file, int line);
+/* The GC root stack: addresses of protected variables, pushed by PROTVAR and
+ * friends and popped all at once by UNPROTECT, which just resets the stack
+ * pointer to the value saved by PROTECT. Nothing is allocated to protect a
+ * variable.
+ */
+extern obp_t **gc_roots;
+extern uint gc_roots_top;
+
+uint gc_start_protect(char *file, int line);
 void gc_protect(char *what, int line, obp_t *obpp);
-void gc_unprotect(gcp_t prot_state, char *file, int line);
+void gc_unprotect(uint prot_state, char *file, int line);
 
-#define PROTECT gcp_t gc_prot_state = gc_start_protect(__FILE__, __LINE__)
+#define PROTECT uint gc_prot_state = gc_start_protect(__FILE__, __LINE__)
 #define UNPROTECT gc_unprotect(gc_prot_state, __FILE__, __LINE__)
 #define PROTVAR(var) obp_t var = the_Nil; \
         gc_protect(__FILE__":"#var, __LINE__, &var)
 #define PROTVAL(var, val) obp_t var = val; \
         gc_protect(__FILE__":"#var, __LINE__, &var)
 
-void gc();
+/**
+ * Collect garbage; a minor collection, unless the old generation has grown
+ * enough to make a major one due.
+ */
+void gc(void);
+
+/**
+ * Do a major collection of the whole heap.
+ */
+void gc_full(void);
+
+/**
+ * Do a slice of incremental marking if one is due; to be called on allocation
+ * while gc_marking is set.
+ */
+void gc_step(void);
+
+extern int gc_incremental;              /* mark in slices between allocations */
+extern uint gc_slice_work;              /* objects to scan per slice */
+extern uint gc_slice_usecs;             /* time budget per slice, if non-zero */
+extern int gc_marking;                  /* an incremental cycle is marking */
+extern uint gc_threads;                 /* number of marking threads */
+extern double gc_growth;                /* target heap growth factor */
+extern ulong gc_alloc_bytes;            /* allocated since the last cycle */
+extern ulong gc_trigger_bytes;          /* allocation that starts a cycle */
+extern double gc_mem_fraction;          /* of the limit to stay below; 0: off */
+extern ulong gc_mem_limit;              /* the memory limit in bytes */
+
+void gc_write_barrier_slow(obp_t ob, obp_t val);
+
+/**
+ * The write barrier of the GC, to be called after a reference to val has been
+ * stored into ob. If ob is marked and val is not, then while incremental
+ * marking is in progress val is marked, otherwise ob goes into the remembered
+ * set, so the next minor collection finds val.
+ */
+static inline void gc_write_barrier(obp_t ob, obp_t val)
+{
+        if (val && !IS_IMMEDIATE(val) && heap_marked(ob)
+            && !heap_marked(val)) {
+                gc_write_barrier_slow(ob, val);
+        }
+}
 
 #define protect(obvar) gc_protect(__FILE__":"#obvar, __LINE__, &obvar)
 
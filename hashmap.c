@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "hashmap.h"
 #include "objects.h"
@@ -53,19 +54,12 @@ static int eq_eq(obp_t ob1, obp_t ob2)
 static int eq_eqv(obp_t ob1, obp_t ob2)
 {
         if (ob1 == ob2) {
-/*              printf("hashmap:eq_eqv: ob1 == ob2\n"); */
                 return 1;
+        } else if (IS_IMMEDIATE(ob1) || IS_IMMEDIATE(ob2)) {
+                return 0;               /* would be the same if equal */
         } else if (ob1->eq_is_eqv) {    /* must compare contents */
-/*              printf("hashmap:eq_eqv: compare\n"); */
-/*              xdump(stdout, ob1, ob1->size); */
-/*              printf(".\n"); */
-/*              xdump(stdout, ob2, ob2->size); */
-                return ob1->size == ob2->size
-                        && !memcmp(&ob1->size,
-                                   &ob2->size,
-                                   ob1->size - offsetof(Lobject_t, size));
+                return contents_equal(ob1, ob2);
         } else {
-/*              printf("hashmap:eq_eqv: ob1 != ob2\n"); */
                 return 0;
         }
 }
@@ -83,35 +77,121 @@ eq_func_t eq_funcs[] = {
 };
 
 
+int contents_equal(obp_t ob1, obp_t ob2)
+{
+        if (ob1->type != ob2->type) {
+                return 0;
+        }
+        switch (ob1->type) {
+            case STRING: {
+                    Lstring_t *s1 = AS(ob1, STRING);
+                    Lstring_t *s2 = AS(ob2, STRING);
+                    if (s1->length != s2->length
+                        || (s1->hash && s2->hash && s1->hash != s2->hash)) {
+                            return 0;
+                    }
+                    return !memcmp(s1->content, s2->content, s1->length);
+            }
+            case NUMBER:
+                return ob1->num_is_int == ob2->num_is_int
+                        && AS(ob1, NUMBER)->value.i
+                        == AS(ob2, NUMBER)->value.i;
+            case BIGNUM: {
+                    Lbignum_t *b1 = AS(ob1, BIGNUM);
+                    Lbignum_t *b2 = AS(ob2, BIGNUM);
+                    return b1->negative == b2->negative
+                            && b1->ndigits == b2->ndigits
+                            && !memcmp(b1->digit, b2->digit,
+                                       b1->ndigits * sizeof(uint32_t));
+            }
+            default:
+                return OB_SIZE(ob1) == OB_SIZE(ob2)
+                        && !memcmp(ob1, ob2, OB_SIZE(ob1));
+        }
+}
+
+
+#define HASH_K1 0x87c37b91114253d5ULL
+#define HASH_K2 0x4cf5ad432745937fULL
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
 /**
- * Hash function using FNV-1a algorithm.
+ * Hash len bytes a 64-bit word at a time, finishing with the MurmurHash3
+ * finalizer. Never returns 0, which marks a hash code not yet cached.
  */
-static int hash_index(hashmap_t map, obp_t key)
+static uint hash_bytes(const void *p, size_t len)
+{
+        const uchar *s = p;
+        uint64_t h = len * HASH_K2;
+        uint64_t w;
+
+        for (; len >= sizeof(w); s += sizeof(w), len -= sizeof(w)) {
+                memcpy(&w, s, sizeof(w));
+                h ^= ROTL64(w * HASH_K1, 31) * HASH_K2;
+                h = ROTL64(h, 27) * 5 + 0x52dce729;
+        }
+        if (len) {
+                w = 0;
+                memcpy(&w, s, len);
+                h ^= ROTL64(w * HASH_K1, 31) * HASH_K2;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return (uint) h ? (uint) h : 1;
+}
+
+
+uint string_hash(char *s, uint len)
 {
-        unsigned int hashval = 2166136261;
-        unsigned int i;
-        char *s;
-        int keylen;
-
-        if (key->eq_is_eqv) {           /* must compare contents */
-                s = (char *) &(key->size);
-                keylen = key->size - offsetof(Lobject_t, size);
-        } else {                        /* need only compare pointer */
-                s = (char *) &key;
-                keylen = sizeof(key);
+        return hash_bytes(s, len);
+}
+
+
+/**
+ * Return the hash code of a key. Strings and numbers compared by contents
+ * cache theirs, as they are immutable.
+ */
+static uint key_hash(obp_t key)
+{
+        if (IS_IMMEDIATE(key) || !key->eq_is_eqv) { /* compare pointer */
+                return hash_bytes(&key, sizeof(key));
         }
-        for (i = 0; i < keylen; i++) {
-                hashval ^= s[i];
-                hashval *= 16777619;
+        switch (key->type) {
+            case STRING: {
+                    Lstring_t *s = AS(key, STRING);
+                    if (!s->hash) {
+                            s->hash = string_hash(s->content, s->length);
+                    }
+                    return s->hash;
+            }
+            case NUMBER: {
+                    Lnumber_t *n = AS(key, NUMBER);
+                    if (!n->hash) {
+                            n->hash = hash_bytes(&n->value, sizeof(n->value));
+                    }
+                    return n->hash;
+            }
+            case BIGNUM: {
+                    Lbignum_t *b = AS(key, BIGNUM);
+                    if (!b->hash) {
+                            b->hash = hash_bytes(b->digit, b->ndigits
+                                                 * sizeof(uint32_t))
+                                    ^ b->negative;
+                    }
+                    return b->hash;
+            }
+            default:
+                return hash_bytes(key, OB_SIZE(key));
         }
-/*      printf("hash value of "); */
-/* #ifndef HASHMAP_MAIN */
-/*      describe(key); */
-/* #else */
-/*      printf("%*s ", THE_STRINGL(key)); */
-/* #endif        */
-/*      printf("is %u\n", hashval); */
-        return hashval % map->n_buckets;
+}
+
+
+static int hash_index(hashmap_t map, obp_t key)
+{
+        return key_hash(key) % map->n_buckets;
 }
 
 
@@ -235,6 +315,23 @@ mapentry_t hashmap_get_entry(hashmap_t map, obp_t key)
 }
 
 
+obp_t hashmap_get_string(hashmap_t map, char *s, uint len, uint hash)
+{
+        mapentry_t elp = map->table[hash % map->n_buckets];
+
+        for (; elp; elp = elp->next) {
+                if (IS(elp->key, STRING)) {
+                        Lstring_t *key = AS(elp->key, STRING);
+                        if (key->length == len
+                            && !memcmp(key->content, s, len)) {
+                                return elp->value;
+                        }
+                }
+        }
+        return NULL;
+}
+
+
 void entry_put_value(mapentry_t entry, obp_t value)
 {
         entry->value = value;
@@ -326,7 +423,16 @@ obp_t hashmap_pairs(hashmap_t map)
 
 void hashmap_destroy(hashmap_t map)
 {
-        
+        for (int bucket = 0; bucket < map->n_buckets; bucket++) {
+                mapentry_t el = map->table[bucket];
+                while (el) {
+                        mapentry_t next = el->next;
+                        xfree(el);
+                        el = next;
+                }
+        }
+        xfree(map->table);
+        xfree(map);
 }
 
 
@@ -367,6 +473,16 @@ mapentry_t hashmap_enum_next(hashmap_t map)
         return ent;
 }
 
+void hashmap_walk(hashmap_t map,
+                  void (*func)(obp_t key, obp_t value, void *arg), void *arg)
+{
+        for (int bucket = 0; bucket < map->n_buckets; bucket++) {
+                for (mapentry_t el = map->table[bucket]; el; el = el->next) {
+                        func(el->key, el->value, arg);
+                }
+        }
+}
+
 
 #ifdef HASHMAP_MAIN                             \
 
@@ -20,6 +20,20 @@ int hashmap_put(hashmap_t map, obp_t key, obp_t value);
 
 obp_t hashmap_get(hashmap_t map, obp_t key);
 
+/* Hash a string as a map does a string key.
+ */
+uint string_hash(char *s, uint len);
+
+/* Return non-zero iff two heap objects are of the same type and have the same
+ * contents. Only the payload is compared, not header bits or cached hashes.
+ */
+int contents_equal(obp_t ob1, obp_t ob2);
+
+/* Look up a string key by its contents, without making a string object; hash
+ * must be string_hash(s, len). Only meaningful in an EQ_EQV map.
+ */
+obp_t hashmap_get_string(hashmap_t map, char *s, uint len, uint hash);
+
 hashmap_t hashmap_create(eq_type_t eq_type);
 
 unsigned int hashmap_size(hashmap_t map);
@@ -48,4 +62,11 @@ void hashmap_enum_start(hashmap_t map);
 
 mapentry_t hashmap_enum_next(hashmap_t map);
 
+/* Call func with each key and value in the map, and the arg. Unlike the
+ * enumeration above, this keeps no state in the map, so it may be used while an
+ * enumeration is in progress, e. g. by the GC.
+ */
+void hashmap_walk(hashmap_t map,
+                  void (*func)(obp_t key, obp_t value, void *arg), void *arg);
+
 #endif  /* __HASHMAP_H_INC */
@@ -0,0 +1,373 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * The object heap: segregated-fit pages, one size class per page. See heap.h
+ * for the page layout.
+ */
+
+#include "cbasics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "objects.h"
+#include "heap.h"
+
+/* One size class per freelist entry, indexed by object size in units of
+ * OBSIZE_UNIT. Each class has a list of its swept pages and a list of those
+ * that have free slots; allocation happens in the first of the latter.
+ *
+ * Sweeping is lazy: after marking, all pages of a class are moved to its list
+ * of unswept pages, and heap_alloc() sweeps them one at a time when it runs
+ * out of free slots. So the sweep is not part of the GC pause, and pages that
+ * are not needed are not touched until the next collection finishes sweeping.
+ */
+typedef struct HEAP_CLASS {
+        heap_page_t *pages;             /* swept pages of this class */
+        heap_page_t *avail;             /* pages with free slots */
+        heap_page_t *unswept;           /* pages still to be swept */
+} heap_class_t;
+
+static heap_class_t classes[FREELIST_ENTRIES];
+static heap_page_t *large_pages;        /* pages with a single large object */
+static heap_page_t *empty_pages;        /* released pages kept for reuse */
+static ulong os_pagesize;
+static uint sweep_visited;              /* objects visited by this sweep */
+static uint sweep_freed;                /* objects freed by this sweep */
+
+long ob_sizecount[FREELIST_ENTRIES];    /* count free slots per size */
+
+
+/* the slot area starts after the page header */
+#define SLOTS_OFFSET ((sizeof(heap_page_t) + 15) & ~15UL)
+
+#define SLOT_ADDR(page, slot) ((page)->start + (ulong) (slot) * (page)->size)
+
+
+/**
+ * Map memory of the specified length, aligned to HEAP_PAGE_SIZE.
+ */
+static char *map_aligned(ulong length)
+{
+        ulong maplen = length + HEAP_PAGE_SIZE;
+        char *mem = mmap(0, maplen, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+                fprintf(stderr, "PANIC! could not map %lu bytes for the heap\n",
+                        maplen);
+                exit(1);
+        }
+        char *start = (char *) (((ulong) mem + HEAP_PAGE_SIZE - 1)
+                                & ~(ulong) (HEAP_PAGE_SIZE - 1));
+        if (start > mem) {
+                munmap(mem, start - mem);
+        }
+        if (mem + maplen > start + length) {
+                munmap(start + length, mem + maplen - (start + length));
+        }
+        return start;
+}
+
+
+/**
+ * Initialize the header of a page for the specified slot size.
+ */
+static void init_page(heap_page_t *page, uint size, uint nslots, ulong mapsize)
+{
+        memset(page, 0, sizeof(*page));
+        page->size = size;
+        page->recip = ((1UL << 32) + size - 1) / size;
+        page->nslots = nslots;
+        page->mapsize = mapsize;
+        page->start = (char *) page + SLOTS_OFFSET;
+}
+
+
+/**
+ * Get a fresh page for the specified slot size, preferably one that has been
+ * released before.
+ */
+static heap_page_t *new_page(uint size)
+{
+        heap_page_t *page = empty_pages;
+
+        if (page) {
+                empty_pages = page->next;
+        } else {
+                page = (heap_page_t *) map_aligned(HEAP_PAGE_SIZE);
+        }
+        init_page(page, size, (HEAP_PAGE_SIZE - SLOTS_OFFSET) / size,
+                  HEAP_PAGE_SIZE);
+        ob_sizecount[size / OBSIZE_UNIT] += page->nslots;
+        return page;
+}
+
+
+/**
+ * Allocate an object too large for the size classes in a page of its own. If
+ * it fits in HEAP_PAGE_SIZE, the page is an ordinary one, taken from and given
+ * back to the empty pages, as large objects like bignums are often short-lived.
+ */
+static void *large_alloc(uint size)
+{
+        ulong length = (SLOTS_OFFSET + size + os_pagesize - 1)
+                & ~(os_pagesize - 1);
+        heap_page_t *page;
+
+        if (length <= HEAP_PAGE_SIZE) {
+                length = HEAP_PAGE_SIZE;
+                page = empty_pages;
+                if (page) {
+                        empty_pages = page->next;
+                } else {
+                        page = (heap_page_t *) map_aligned(length);
+                }
+        } else {
+                page = (heap_page_t *) map_aligned(length);
+        }
+
+        init_page(page, size, 1, length);
+        page->alloc[0] = 1;
+        page->nlive = 1;
+        page->is_large = 1;
+        page->next = large_pages;
+        large_pages = page;
+        return page->start;
+}
+
+
+/**
+ * Find a free slot in the page, mark it allocated, and return it; return 0 if
+ * the page is full.
+ */
+static void *page_alloc(heap_page_t *page)
+{
+        uint nwords = (page->nslots + 63) / 64;
+
+        for (uint w = page->cursor; w < nwords; w++) {
+                ulong free = ~page->alloc[w];
+                if (w == nwords - 1 && page->nslots % 64) {
+                        free &= (1UL << (page->nslots % 64)) - 1;
+                }
+                if (free) {
+                        uint bit = __builtin_ctzl(free);
+                        page->alloc[w] |= 1UL << bit;
+                        page->cursor = w;
+                        page->nlive++;
+                        return SLOT_ADDR(page, w * 64 + bit);
+                }
+        }
+        page->cursor = nwords;
+        return 0;
+}
+
+
+/**
+ * Give the memory of an empty page back to the OS. The first OS page, which
+ * holds the page header, stays mapped so the page can be kept in the list of
+ * empty pages for reuse.
+ */
+static void release_page(heap_page_t *page)
+{
+        ob_sizecount[page->size / OBSIZE_UNIT] -= page->nslots;
+        madvise((char *) page + os_pagesize, HEAP_PAGE_SIZE - os_pagesize,
+                MADV_DONTNEED);
+        page->next = empty_pages;
+        empty_pages = page;
+}
+
+
+/**
+ * Sweep a page: the allocated slots that are not marked are freed. Only those
+ * that need finalization are touched, all others just by clearing the bits.
+ */
+static void sweep_page(heap_page_t *page)
+{
+        uint nwords = (page->nslots + 63) / 64;
+        uint nlive = 0;
+
+        for (uint w = 0; w < nwords; w++) {
+                ulong alloc = page->alloc[w];
+                if (!alloc) {
+                        continue;
+                }
+                ulong live = alloc & page->mark[w];
+                ulong dead = alloc & ~live;
+                ulong fin = dead & page->finalize[w];
+                while (fin) {
+                        free_obj((obp_t) SLOT_ADDR(page, w * 64
+                                                   + __builtin_ctzl(fin)));
+                        fin &= fin - 1;
+                }
+                page->alloc[w] = live;
+                page->finalize[w] &= live;
+                sweep_visited += __builtin_popcountl(alloc);
+                sweep_freed += __builtin_popcountl(dead);
+                nlive += __builtin_popcountl(live);
+        }
+        if (!page->is_large) {
+                ob_sizecount[page->size / OBSIZE_UNIT] += page->nlive - nlive;
+        }
+        page->nlive = nlive;
+        page->cursor = 0;
+}
+
+
+/**
+ * Sweep the next unswept page of a class and put it back into its lists, or
+ * release it if it has become empty. Return 0 if there was none left.
+ */
+static int sweep_next(heap_class_t *cls)
+{
+        heap_page_t *page = cls->unswept;
+
+        if (page == 0) {
+                return 0;
+        }
+        cls->unswept = page->next;
+        sweep_page(page);
+        if (page->nlive == 0) {
+                release_page(page);
+                return 1;
+        }
+        page->next = cls->pages;
+        cls->pages = page;
+        if (page->nlive < page->nslots) {
+                page->next_avail = cls->avail;
+                cls->avail = page;
+        }
+        return 1;
+}
+
+
+void *heap_alloc(uint size)
+{
+        if (!os_pagesize) {
+                os_pagesize = sysconf(_SC_PAGESIZE);
+        }
+        if (size < HEAP_MIN_SLOT) {
+                size = HEAP_MIN_SLOT;
+        }
+        if (size > FREELIST_MAXSIZE) {
+                return large_alloc(size);
+        }
+
+        heap_class_t *cls = &classes[size / OBSIZE_UNIT];
+        heap_page_t *page;
+        void *ob;
+
+        ob_sizecount[size / OBSIZE_UNIT]--;
+        do {
+                while ((page = cls->avail)) {
+                        if ((ob = page_alloc(page))) {
+                                return ob;
+                        }
+                        cls->avail = page->next_avail;
+                }
+        } while (sweep_next(cls));
+
+        page = new_page(size);
+        page->next = cls->pages;
+        cls->pages = page;
+        page->next_avail = 0;
+        cls->avail = page;
+        return page_alloc(page);
+}
+
+
+void heap_set_finalize(obp_t ob)
+{
+        heap_page_t *page = HEAP_PAGE_OF(ob);
+        uint slot = HEAP_SLOT(page, ob);
+        page->finalize[slot / 64] |= 1UL << (slot % 64);
+}
+
+
+void heap_free(obp_t ob)
+{
+        heap_page_t *page = HEAP_PAGE_OF(ob);
+        uint slot = HEAP_SLOT(page, ob);
+        ulong bit = 1UL << (slot % 64);
+
+        page->alloc[slot / 64] &= ~bit;
+        page->mark[slot / 64] &= ~bit;
+        page->finalize[slot / 64] &= ~bit;
+        page->remembered[slot / 64] &= ~bit;
+        page->nlive--;
+        if (slot / 64 < page->cursor) {
+                page->cursor = slot / 64;
+        }
+        if (!page->is_large) {
+                ob_sizecount[page->size / OBSIZE_UNIT]++;
+        }
+}
+
+
+void heap_release_empty(void)
+{
+        heap_page_t *page;
+
+        while ((page = empty_pages)) {
+                empty_pages = page->next;
+                munmap(page, HEAP_PAGE_SIZE);
+        }
+}
+
+
+void heap_clear_marks(void)
+{
+        for (int i = 0; i < FREELIST_ENTRIES; i++) {
+                for (heap_page_t *page = classes[i].pages; page;
+                     page = page->next) {
+                        memset(page->mark, 0, sizeof(page->mark));
+                }
+        }
+        for (heap_page_t *page = large_pages; page; page = page->next) {
+                memset(page->mark, 0, sizeof(page->mark));
+        }
+}
+
+
+void heap_sweep(void)
+{
+        sweep_visited = 0;
+        sweep_freed = 0;
+        for (int i = 0; i < FREELIST_ENTRIES; i++) {
+                heap_class_t *cls = &classes[i];
+                cls->unswept = cls->pages;
+                cls->pages = 0;
+                cls->avail = 0;
+        }
+
+        heap_page_t **pp = &large_pages;
+        heap_page_t *page;
+        while ((page = *pp)) {
+                sweep_page(page);
+                if (page->nlive == 0) {
+                        *pp = page->next;
+                        if (page->mapsize == HEAP_PAGE_SIZE) {
+                                page->next = empty_pages;
+                                empty_pages = page;
+                        } else {
+                                munmap(page, page->mapsize);
+                        }
+                } else {
+                        pp = &page->next;
+                }
+        }
+}
+
+
+void heap_finish_sweep(uint *visited, uint *freed)
+{
+        for (int i = 0; i < FREELIST_ENTRIES; i++) {
+                while (sweep_next(&classes[i])) {
+                        ;
+                }
+        }
+        *visited = sweep_visited;
+        *freed = sweep_freed;
+}
+
+/* EOF */
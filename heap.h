@@ -0,0 +1,143 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * The object heap: segregated-fit pages, one size class per page
+ */
+
+#ifndef __HEAP_H_INC
+#define __HEAP_H_INC
+
+#include "cbasics.h"
+#include "tunables.h"
+
+/* Objects live in pages of HEAP_PAGE_SIZE bytes, aligned to their size, so the
+ * page header of an object is found by masking its address. All slots of a
+ * page have the same size, which is kept in the page header and not in the
+ * objects. Objects too large for a size class get a page of their own, which
+ * may be larger than HEAP_PAGE_SIZE, but the object still starts in the first
+ * HEAP_PAGE_SIZE bytes.
+ *
+ * Which slots are allocated, marked by the GC, in the GC's remembered set, or
+ * hold an object that needs finalization is kept in bitmaps in the page
+ * header, one bit per slot, so neither marking nor sweeping touches the
+ * objects themselves.
+ */
+
+/* the smallest slot; bounds the size of the page bitmaps */
+#define HEAP_MIN_SLOT 16
+
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_MIN_SLOT / 64)
+
+typedef struct HEAP_PAGE {
+        struct HEAP_PAGE *next;         /* next page of the same class */
+        struct HEAP_PAGE *next_avail;   /* next page with free slots */
+        char *start;                    /* first slot */
+        ulong mapsize;                  /* length of the mapping */
+        uint size;                      /* size of the slots */
+        uint recip;                     /* 2^32 / size, rounded up */
+        uint nslots;                    /* number of slots */
+        uint nlive;                     /* number of allocated slots */
+        uint cursor;                    /* bitmap word to search first */
+        uint is_large:1;                /* page holds a single large object */
+        ulong alloc[HEAP_BITMAP_WORDS];   /* allocated slots */
+        ulong mark[HEAP_BITMAP_WORDS];    /* slots marked by the GC */
+        ulong finalize[HEAP_BITMAP_WORDS]; /* slots to finalize when freed */
+        ulong remembered[HEAP_BITMAP_WORDS]; /* slots in the remembered set */
+} heap_page_t;
+
+#define HEAP_PAGE_OF(ob) \
+        ((heap_page_t *) ((ulong) (ob) & ~(ulong) (HEAP_PAGE_SIZE - 1)))
+
+/* the allocated size of an object */
+#define OB_SIZE(ob) (HEAP_PAGE_OF(ob)->size)
+
+/* the slot number of an object in its page; the offset times the rounded-up
+ * reciprocal is exact for all offsets in a page
+ */
+#define HEAP_SLOT(page, ob)                                             \
+        ((uint) (((ulong) ((char *) (ob) - (page)->start) * (page)->recip) \
+                 >> 32))
+
+
+/**
+ * Return non-zero iff the object has been marked by the GC.
+ */
+static inline int heap_marked(obp_t ob)
+{
+        heap_page_t *page = HEAP_PAGE_OF(ob);
+        uint slot = HEAP_SLOT(page, ob);
+        return (__atomic_load_n(&page->mark[slot / 64], __ATOMIC_RELAXED)
+                >> (slot % 64)) & 1;
+}
+
+/**
+ * Mark the object for the GC.
+ */
+static inline void heap_set_mark(obp_t ob)
+{
+        heap_page_t *page = HEAP_PAGE_OF(ob);
+        uint slot = HEAP_SLOT(page, ob);
+        page->mark[slot / 64] |= 1UL << (slot % 64);
+}
+
+/**
+ * Mark the object atomically, for marking threads running in parallel; return
+ * non-zero iff it was not marked before.
+ */
+static inline int heap_test_and_mark(obp_t ob)
+{
+        heap_page_t *page = HEAP_PAGE_OF(ob);
+        uint slot = HEAP_SLOT(page, ob);
+        ulong bit = 1UL << (slot % 64);
+
+        if (__atomic_load_n(&page->mark[slot / 64], __ATOMIC_RELAXED) & bit) {
+                return 0;
+        }
+        return !(__atomic_fetch_or(&page->mark[slot / 64], bit,
+                                   __ATOMIC_RELAXED) & bit);
+}
+
+/**
+ * Allocate a slot for an object of the specified size, which must be a
+ * multiple of OBSIZE_UNIT. The memory is not cleared.
+ */
+void *heap_alloc(uint size);
+
+/**
+ * Have the object finalized by free_obj() when it is collected.
+ */
+void heap_set_finalize(obp_t ob);
+
+/**
+ * Give the slot of an object back to its page.
+ */
+void heap_free(obp_t ob);
+
+/**
+ * Unmap the empty pages kept for reuse completely.
+ */
+void heap_release_empty(void);
+
+/**
+ * Clear the marks of all objects.
+ */
+void heap_clear_marks(void);
+
+/**
+ * Begin to free all unmarked objects, finalizing those that need it, and to
+ * give empty pages back to the OS. Only large objects are swept right away;
+ * the pages of the size classes are swept lazily on allocation. The marks stay
+ * set, see gc.c.
+ */
+void heap_sweep(void);
+
+/**
+ * Sweep all pages not yet swept since the last heap_sweep(), as must be done
+ * before marking again, and return the numbers of objects visited and freed
+ * by the whole sweep.
+ */
+void heap_finish_sweep(uint *visited, uint *freed);
+
+
+#endif  /* __HEAP_H_INC */
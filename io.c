@@ -42,6 +42,7 @@ char *port_type_name(port_type_t type)
 obp_t make_stream_port(char *fname, char *fmode)
 {
         FILE *stream = fopen(fname, fmode);
+        PROTECT;
         PROTVAR(retval);
         if (stream == 0) {
                 ERROR(the_Stderr, ERR_SYSTEM, 0, "error opening %s: %s",
@@ -51,6 +52,7 @@ obp_t make_stream_port(char *fname, char *fmode)
         int out = strchr("wa", fmode[0]) || fmode[1] == '+';
         retval = new_port(fname, stream, -1, 0, STREAM_PORT, in, out);
     EXIT:
+        UNPROTECT;
         return retval;
 }
 
@@ -145,6 +147,7 @@ obp_t port_write(obp_t port, char *s, uint len)
 obp_t port_vprintf(obp_t port, char *format, va_list arglist)
 {
         char *string ;
+        PROTECT;
         PROTVAR(retval);
 
         int vasprintf_ret = vasprintf(&string, format, arglist);
@@ -155,6 +158,7 @@ obp_t port_vprintf(obp_t port, char *format, va_list arglist)
         retval = port_print(port, string);
         free(string);
     EXIT:
+        UNPROTECT;
         return retval;
 }
 
@@ -217,6 +221,7 @@ obp_t port_read(obp_t port, uint len)
         Lport_t *p = AS(port, PORT);
         char *read_buf = 0;
         int read_ret;
+        PROTECT;
         PROTVAR(retval);
 
         if (p->closed) {
@@ -252,11 +257,13 @@ obp_t port_read(obp_t port, uint len)
         retval = new_string(read_buf, read_ret);
     EXIT:
         free(read_buf);
+        UNPROTECT;
         return retval;
 }
 
 obp_t close_port(obp_t port)
 {
+        PROTECT;
         PROTVAR(retval);
         if (!IS(port, PORT)) {
                 ERROR(the_Stderr, ERR_INVARG, port, "port argument needed");
@@ -289,6 +296,7 @@ obp_t close_port(obp_t port)
         }
         retval = port;
     EXIT:
+        UNPROTECT;
         return retval;
 }
 
@@ -300,13 +308,17 @@ obp_t load_file(char *fname, session_context_t *sc, int level)
         CHECK_ERROR(new_in);
         PROTVAL(saved_port, sc->in);
         int saved_int = sc->is_interactive;
+        uint depth = specpdl_top;
 
+        /* each file starts with dynamic binding */
+        specbind(the_Lexical_binding, the_Nil);
         sc->in = new_in;
         sc->is_interactive = 0;
         retval = repl(sc, level);
         close_port(new_in);
         sc->is_interactive = saved_int;
         sc->in = saved_port;
+        unbind_to(depth);
     EXIT:
         UNPROTECT;
         return retval;
@@ -321,13 +333,19 @@ void init_io(void)
         protect(the_Stderr);
 
         the_Stdin = new_port("*stdin*", stdin, -1, 0, STREAM_PORT, 1, 0);
-        AS(intern_z(STDIN_PORT_NAME), SYMBOL)->value = the_Stdin;
+        name = intern_z(STDIN_PORT_NAME);
+        AS(name, SYMBOL)->value = the_Stdin;
+        gc_write_barrier(name, the_Stdin);
 
         the_Stdout = new_port("*stdout*", stdout, -1, 0, STREAM_PORT, 0, 1);
-        AS(intern_z(STDOUT_PORT_NAME), SYMBOL)->value = the_Stdout;
+        name = intern_z(STDOUT_PORT_NAME);
+        AS(name, SYMBOL)->value = the_Stdout;
+        gc_write_barrier(name, the_Stdout);
 
         the_Stderr = new_port("*stderr*", stderr, -1, 0, STREAM_PORT, 0, 1);
-        AS(intern_z(STDERR_PORT_NAME), SYMBOL)->value = the_Stderr;
+        name = intern_z(STDERR_PORT_NAME);
+        AS(name, SYMBOL)->value = the_Stderr;
+        gc_write_barrier(name, the_Stderr);
         
         UNPROTECT;
 }
@@ -5,22 +5,31 @@
  * here be main()
  */
 
+#include "cbasics.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sysexits.h>
 #include "builtins.h"
 #include "io.h"
+#include "memlimit.h"
 #include "session.h"
 #include "reader.h"
 #include "signals.h"
 #include "printer.h"
 #include "numbers.h"
+#include "gc.h"
+#include "bytecode.h"
+#include "eval.h"
 
 #define PROGRAM_NAME "hsl"
 
 extern int getopt(int argc, char * const argv[], const char *optstring);
 extern int optind;
+extern char *optarg;
 
 int opt_trace = 0;
 int opt_interactive = 1;
@@ -32,10 +41,38 @@ void usage(FILE *out, char *message)
                 fputs(message, out);
                 putc('\n', out);
         }
-        fputs("usage: " PROGRAM_NAME " [-it] [file1 ...]\n", out);
+        fputs("usage: " PROGRAM_NAME " [-itIC] [-G growth] [-W work]"
+              " [-U usecs] [-P threads]\n"
+              "           [-M fraction] [-L limit] [-D depth] [file1 ...]\n"
+              "  -C: compile functions to bytecode when defined\n"
+              "  -D: maximum nesting depth of function calls\n"
+              "  -G: heap growth factor between garbage collections\n"
+              "  -I: incremental garbage collection\n"
+              "  -W: objects to mark per incremental GC slice\n"
+              "  -U: time budget per incremental GC slice in microseconds\n"
+              "  -P: number of parallel marking threads, at most one per CPU\n"
+              "  -M: keep memory use below this fraction of the limit\n"
+              "  -L: memory limit in bytes (default: the cgroup's)\n",
+              out);
         exit(out == stderr ? EX_USAGE : 0);
 }
 
+/* the value of a numeric option argument, or a usage error unless it is a
+ * number from min to max
+ */
+static uint number_arg(char *arg, uint min, uint max, char *message)
+{
+        char *end;
+
+        errno = 0;
+        ulong value = strtoul(arg, &end, 10);
+        if (end == arg || *end || errno == ERANGE || strchr(arg, '-')
+            || value < min || value > max) {
+                usage(stderr, message);
+        }
+        return value;
+}
+
 
 int main(int argc, char *argv[])
 {
@@ -44,7 +81,7 @@ int main(int argc, char *argv[])
                                            had files to load on the command
                                            line */
         
-        while ((opt_char = getopt(argc, argv, "hit?")) != EOF) {
+        while ((opt_char = getopt(argc, argv, "hitCD:G:IW:U:P:M:L:?")) != EOF) {
                 switch (opt_char) {
                     case 'i':
                         opt_interactive = 1;
@@ -52,6 +89,46 @@ int main(int argc, char *argv[])
                     case 't':
                         opt_trace = 1;
                         break;
+                    case 'C':
+                        compile_on_defun = 1;
+                        break;
+                    case 'D':
+                        max_depth = number_arg(optarg, 1, UINT_MAX,
+                                               "depth must be positive");
+                        break;
+                    case 'G':
+                        gc_growth = atof(optarg);
+                        if (!(gc_growth > 1)) {
+                                usage(stderr, "growth factor must be above 1");
+                        }
+                        break;
+                    case 'I':
+                        gc_incremental = 1;
+                        break;
+                    case 'W':
+                        gc_slice_work = number_arg(optarg, 1, UINT_MAX,
+                                                   "slice work must be "
+                                                   "positive");
+                        break;
+                    case 'U':
+                        gc_slice_usecs = number_arg(optarg, 0, UINT_MAX,
+                                                    "bad slice time budget");
+                        break;
+                    case 'P':
+                        gc_threads = number_arg(optarg, 1,
+                                                sysconf(_SC_NPROCESSORS_ONLN),
+                                                "thread count must be from 1 "
+                                                "to the number of CPUs");
+                        break;
+                    case 'M':
+                        gc_mem_fraction = atof(optarg);
+                        if (!(gc_mem_fraction > 0 && gc_mem_fraction <= 1)) {
+                                usage(stderr, "bad memory fraction");
+                        }
+                        break;
+                    case 'L':
+                        gc_mem_limit = strtoul(optarg, 0, 10);
+                        break;
                     case 'h':
                         usage(stdout, 0);
                         break;
@@ -61,13 +138,24 @@ int main(int argc, char *argv[])
                 }
         }
 
+        if (gc_mem_fraction && gc_mem_limit == 0) {
+                gc_mem_limit = memlimit_cgroup();
+                if (gc_mem_limit == 0) {
+                        fputs(PROGRAM_NAME ": no memory limit, -M ignored\n",
+                              stderr);
+                        gc_mem_fraction = 0;
+                }
+        }
+
         setbuf(stdout, 0);
         setbuf(stderr, 0);
+        init_eval();
         init_objects();
         init_io();
         init_reader();
         init_builtins();
         init_numbers();
+        init_bytecode();
         if (opt_trace) {
                 traceflag = 1;
         }
@@ -0,0 +1,141 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * The memory limit of the process and its memory usage, read from the cgroup
+ * v2 hierarchy and /proc.
+ */
+
+#include "cbasics.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "memlimit.h"
+
+
+/**
+ * Find the mount point of the cgroup v2 hierarchy in /proc/self/mountinfo,
+ * where the mount point is the fifth field and the file system type follows
+ * the " - " separator. Return 0 if it is not mounted.
+ */
+static int cgroup2_mount(char *buf, int size)
+{
+        FILE *in = fopen("/proc/self/mountinfo", "r");
+        char line[2 * PATH_MAX];
+        int found = 0;
+
+        if (in == 0) {
+                return 0;
+        }
+        while (!found && fgets(line, sizeof(line), in)) {
+                char *sep = strstr(line, " - ");
+                if (sep == 0 || strncmp(sep + 3, "cgroup2 ", 8) != 0) {
+                        continue;
+                }
+                char *field = line;
+                for (int i = 0; i < 4 && field; i++) {
+                        field = strchr(field, ' ');
+                        field = field ? field + 1 : 0;
+                }
+                if (field) {
+                        int len = strcspn(field, " ");
+                        if (len < size) {
+                                memcpy(buf, field, len);
+                                buf[len] = '\0';
+                                found = 1;
+                        }
+                }
+        }
+        fclose(in);
+        return found;
+}
+
+/**
+ * Find the path of the process's cgroup in the v2 hierarchy, which is the line
+ * beginning with "0::" in /proc/self/cgroup. Return 0 if there is none.
+ */
+static int cgroup2_path(char *buf, int size)
+{
+        FILE *in = fopen("/proc/self/cgroup", "r");
+        char line[PATH_MAX];
+        int found = 0;
+
+        if (in == 0) {
+                return 0;
+        }
+        while (!found && fgets(line, sizeof(line), in)) {
+                if (strncmp(line, "0::", 3) == 0) {
+                        int len = strcspn(line + 3, "\n");
+                        if (len < size) {
+                                memcpy(buf, line + 3, len);
+                                buf[len] = '\0';
+                                found = 1;
+                        }
+                }
+        }
+        fclose(in);
+        return found;
+}
+
+/**
+ * Read a memory.max file; return 0 if it does not exist or says "max".
+ */
+static ulong read_max(char *fname)
+{
+        FILE *in = fopen(fname, "r");
+        ulong value = 0;
+
+        if (in) {
+                if (fscanf(in, "%lu", &value) != 1) {
+                        value = 0;
+                }
+                fclose(in);
+        }
+        return value;
+}
+
+
+ulong memlimit_cgroup(void)
+{
+        char mount[PATH_MAX];
+        char path[PATH_MAX];
+        char fname[2 * PATH_MAX + 16];
+        ulong limit = 0;
+
+        if (!cgroup2_mount(mount, sizeof(mount))
+            || !cgroup2_path(path, sizeof(path))) {
+                return 0;
+        }
+        for (;;) {
+                snprintf(fname, sizeof(fname), "%s%s/memory.max", mount, path);
+                ulong max = read_max(fname);
+                if (max && (limit == 0 || max < limit)) {
+                        limit = max;
+                }
+                char *slash = strrchr(path, '/');
+                if (slash == 0) {
+                        break;
+                }
+                *slash = '\0';
+        }
+        return limit;
+}
+
+
+ulong memlimit_rss(void)
+{
+        FILE *in = fopen("/proc/self/statm", "r");
+        ulong resident = 0;
+
+        if (in) {
+                if (fscanf(in, "%*u %lu", &resident) != 1) {
+                        resident = 0;
+                }
+                fclose(in);
+        }
+        return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* EOF */
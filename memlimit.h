@@ -0,0 +1,27 @@
+/* Copyright (c) 2010, 2011 Juergen Nickelsen <ni@jnickelsen.de>
+ * See the file COPYRIGHT for details.
+ */
+/*
+ * The memory limit of the process and its memory usage, so the GC can keep
+ * below the limit
+ */
+
+#ifndef __MEMLIMIT_H_INC
+#define __MEMLIMIT_H_INC
+
+#include "cbasics.h"
+
+/**
+ * Return the memory limit of the cgroup (v2) the process is in, which is the
+ * smallest memory.max of it and its ancestors, or 0 if there is none.
+ */
+ulong memlimit_cgroup(void);
+
+/**
+ * Return the resident set size of the process in bytes, or 0 if it cannot be
+ * determined.
+ */
+ulong memlimit_rss(void);
+
+
+#endif  /* __MEMLIMIT_H_INC */
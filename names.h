@@ -14,6 +14,8 @@
 #define SPLICE_NAME             "splice"
 #define LAMBDA_NAME             "lambda"
 #define SPECIAL_NAME            "mu"
+#define OPTIONAL_NAME           "&optional"
+#define REST_NAME               "&rest"
 #define SETQ_NAME               "setq"
 #define FSET_NAME               "fset"
 #define DEFUN_NAME              "defun"
@@ -78,6 +80,16 @@
 #define LENGTH_NAME             "length"
 #define APROPOS_NAME            "apropos"
 #define GC_NAME                 "gc"
+#define GC_GROWTH_NAME          "gc-growth"
+#define MAX_DEPTH_NAME          "max-depth"
+#define LEXICAL_BINDING_NAME    "lexical-binding"
+#define DECLARE_NAME            "declare"
+#define DEFMACRO_NAME           "defmacro"
+#define MACROEXPAND_NAME        "macroexpand"
+#define MACROEXPAND_1_NAME      "macroexpand-1"
+#define LEXICAL_NAME            "lexical"
+#define SPECIAL_DECL_NAME       "special"
+#define COMPILE_NAME            "compile"
 #define TRACE_FUNCTION_NAME     "trace-function"
 #define SHOW_FREELIST_NAME      "show-freelist"
 #define SUCCESSOR_NAME          "1+"
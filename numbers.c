@@ -10,41 +10,301 @@
 #include "builtins.h"
 #include "names.h"
 #include "numbers.h"
+#include "bignum.h"
 
 
-#define INTRANGE(value) ((value) >= LONG_MIN && (value) <= LONG_MAX)
+/* A number being computed: a long as long as all operands are integers and
+ * no operation overflows, then a bignum; a double once an operand is one.
+ */
+typedef enum { N_INT, N_BIG, N_DOUBLE } numkind_t;
+
+typedef struct NUM {
+        numkind_t kind;
+        long i;
+        double d;
+        bigint_t big;                   /* owned, or borrowed from an
+                                           argument */
+} num_t;
+
+/* Return an error unless all arguments are numbers. Checking them before the
+ * arithmetic begins means no bignum has to be freed on an error.
+ */
+#define CHECK_NUMBERS(argc, argv)                                       \
+        do {                                                            \
+                for (int n_ = 0; n_ < (argc); n_++) {                   \
+                        if (!IS_NUMBER((argv)[n_])) {                   \
+                                return throw_error(sc->out, ERR_INVARG, \
+                                                   (argv)[n_],          \
+                                                   "not of type %s",    \
+                                                   type_name(NUMBER));  \
+                        }                                               \
+                }                                                       \
+        } while (0)
+
+static num_t num_int(long i)
+{
+        num_t n = { N_INT, i, 0 };
+        return n;
+}
+
+static num_t num_double(double d)
+{
+        num_t n = { N_DOUBLE, 0, d };
+        return n;
+}
+
+static num_t num_of(obp_t ob)
+{
+        num_t n = { N_INT, 0, 0 };
+        if (IS(ob, BIGNUM)) {
+                n.kind = N_BIG;
+                big_of(&n.big, ob);
+        } else if (IS_INT(ob)) {
+                n.i = INT_VALUE(ob);
+        } else {
+                n.kind = N_DOUBLE;
+                n.d = AS(ob, NUMBER)->value.d;
+        }
+        return n;
+}
+
+/* a bignum result, as a long if it fits */
+static num_t num_big(bigint_t *b)
+{
+        num_t n = { N_BIG, 0, 0 };
+        if (big_to_long(b, &n.i)) {
+                big_free(b);
+                n.kind = N_INT;
+        } else {
+                n.big = *b;
+        }
+        return n;
+}
+
+/* convert an integer to a bignum */
+static void to_big(num_t *n)
+{
+        if (n->kind == N_INT) {
+                big_from_long(&n->big, n->i);
+                n->kind = N_BIG;
+        }
+}
+
+static void num_free(num_t *n)
+{
+        if (n->kind == N_BIG) {
+                big_free(&n->big);
+        }
+}
+
+/* the value as a double; frees a bignum */
+static double as_double(num_t *n)
+{
+        double d = n->d;
+        if (n->kind == N_INT) {
+                d = n->i;
+        } else if (n->kind == N_BIG) {
+                d = big_to_double(&n->big);
+                big_free(&n->big);
+        }
+        return d;
+}
+
+static obp_t num_object(num_t n)
+{
+        switch (n.kind) {
+            case N_INT:
+                return new_integer(n.i);
+            case N_BIG:
+                return big_object(&n.big);
+            default:
+                return new_double(n.d);
+        }
+}
+
+/* Return non-zero if dividing n by the divisor object is an integer division
+ * by zero; a double dividend or divisor divides by zero as IEEE 754 has it.
+ * A bignum is never zero.
+ */
+static int divides_by_zero(num_t n, obp_t divisor)
+{
+        return n.kind != N_DOUBLE && IS(divisor, NUMBER) && IS_INT(divisor)
+                && INT_VALUE(divisor) == 0;
+}
+
+/* Apply a bignum operation to two integers and free them. */
+static num_t big_op(void (*op)(bigint_t *, bigint_t *, bigint_t *),
+                    num_t a, num_t b)
+{
+        bigint_t r;
+        to_big(&a);
+        to_big(&b);
+        op(&r, &a.big, &b.big);
+        num_free(&a);
+        num_free(&b);
+        return num_big(&r);
+}
+
+/* The operations consume their operands. */
+
+static num_t num_add(num_t a, num_t b)
+{
+        long i;
+        if (a.kind == N_INT && b.kind == N_INT
+            && !__builtin_add_overflow(a.i, b.i, &i)) {
+                return num_int(i);
+        }
+        if (a.kind == N_DOUBLE || b.kind == N_DOUBLE) {
+                return num_double(as_double(&a) + as_double(&b));
+        }
+        return big_op(big_add, a, b);
+}
+
+static num_t num_sub(num_t a, num_t b)
+{
+        long i;
+        if (a.kind == N_INT && b.kind == N_INT
+            && !__builtin_sub_overflow(a.i, b.i, &i)) {
+                return num_int(i);
+        }
+        if (a.kind == N_DOUBLE || b.kind == N_DOUBLE) {
+                return num_double(as_double(&a) - as_double(&b));
+        }
+        return big_op(big_sub, a, b);
+}
+
+static num_t num_mul(num_t a, num_t b)
+{
+        long i;
+        if (a.kind == N_INT && b.kind == N_INT
+            && !__builtin_mul_overflow(a.i, b.i, &i)) {
+                return num_int(i);
+        }
+        if (a.kind == N_DOUBLE || b.kind == N_DOUBLE) {
+                return num_double(as_double(&a) * as_double(&b));
+        }
+        return big_op(big_mul, a, b);
+}
+
+/* An integer only if the division is exact, else a double, so (/ 7 2) is
+ * 3.5. The divisor must not be an integer zero unless a is a double.
+ */
+static num_t num_div(num_t a, num_t b)
+{
+        if (a.kind == N_INT && b.kind == N_INT
+            && !(a.i == LONG_MIN && b.i == -1)) {
+                if (a.i % b.i == 0) {
+                        return num_int(a.i / b.i);
+                }
+        } else if (a.kind != N_DOUBLE && b.kind != N_DOUBLE) {
+                bigint_t q;
+                bigint_t r;
+                to_big(&a);
+                to_big(&b);
+                big_divmod(&q, &r, &a.big, &b.big);
+                if (!r.ndigits) {
+                        big_free(&r);
+                        num_free(&a);
+                        num_free(&b);
+                        return num_big(&q);
+                }
+                big_free(&q);
+                big_free(&r);
+                double d = big_quotient(&a.big, &b.big);
+                num_free(&a);
+                num_free(&b);
+                return num_double(d);
+        }
+        return num_double(as_double(&a) / as_double(&b));
+}
+
+/* The divisor must not be an integer zero unless a is a double. */
+static num_t num_mod(num_t a, num_t b)
+{
+        if (a.kind == N_INT && b.kind == N_INT) {
+                return num_int(b.i == -1 ? 0 : a.i % b.i);
+        }
+        if (a.kind != N_DOUBLE && b.kind != N_DOUBLE) {
+                bigint_t r;
+                to_big(&a);
+                to_big(&b);
+                big_divmod(0, &r, &a.big, &b.big);
+                num_free(&a);
+                num_free(&b);
+                return num_big(&r);
+        }
+        double x = as_double(&a);
+        return num_double(fmod(x, as_double(&b)));
+}
+
+#define CMP_LESS    1
+#define CMP_EQUAL   2
+#define CMP_GREATER 4
+
+/* Compare two numbers; return 0 if they are unordered, i. e. one is a NaN. */
+static int num_compare(obp_t ob1, obp_t ob2)
+{
+        num_t a = num_of(ob1);
+        num_t b = num_of(ob2);
+        int cmp;
+
+        if (a.kind == N_INT && b.kind == N_INT) {
+                cmp = a.i < b.i ? -1 : a.i > b.i;
+        } else if (a.kind == N_DOUBLE || b.kind == N_DOUBLE) {
+                double d1 = as_double(&a);
+                double d2 = as_double(&b);
+                if (!(d1 < d2 || d1 >= d2)) {
+                        return 0;
+                }
+                cmp = d1 < d2 ? -1 : d1 > d2;
+        } else {
+                to_big(&a);
+                to_big(&b);
+                cmp = big_cmp(&a.big, &b.big);
+                num_free(&a);
+                num_free(&b);
+        }
+        return cmp < 0 ? CMP_LESS : cmp > 0 ? CMP_GREATER : CMP_EQUAL;
+}
+
+/* Return t iff each argument compares to the one on its right side with a
+ * result in the accepted set.
+ */
+static obp_t compare_chain(int argc, obp_t *argv, session_context_t *sc,
+                           int accepted)
+{
+        CHECK_NUMBERS(argc, argv);
+        for (int i = 1; i < argc; i++) {
+                if (!(num_compare(argv[i - 1], argv[i]) & accepted)) {
+                        return the_Nil;
+                }
+        }
+        return the_T;
+}
+
 
 /**
  * Return the sum of all arguments, which must be numbers.
  * (+ [n1 ...])
  */
-obp_t bf_plus(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_plus(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        long double value = 0;
-        int is_int = 1;
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                value += AS(arg, NUMBER)->value;
-                is_int &= IS_INT(arg) && INTRANGE(value);
-                args = CDR(args);
+        CHECK_NUMBERS(argc, argv);
+        num_t value = num_int(0);
+        for (int i = 0; i < argc; i++) {
+                value = num_add(value, num_of(argv[i]));
         }
-        obp_t newval = new_ldouble(value);
-        IS_INT(newval) = is_int;
-        return newval;
+        return num_object(value);
 }
 
 /**
  * Return a number that is one more than its argument number.
  * (1+ number)
  */
-obp_t bf_successor(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_successor(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg = CAR(args);
-        long double value = AS(arg, NUMBER)->value + 1;
-        obp_t newval = new_ldouble(value);
-        IS_INT(newval) = IS_INT(arg) && INTRANGE(value);
-        return newval;
+        CHECK_NUMBERS(1, argv);
+        return num_object(num_add(num_of(argv[0]), num_int(1)));
 }
 
 
@@ -52,13 +312,10 @@ obp_t bf_successor(int nargs, obp_t args, session_context_t *sc, int level)
  * Return a number that is one less than its argument number.
  * (1+ number)
  */
-obp_t bf_predecessor(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_predecessor(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg = CAR(args);
-        long double value = AS(arg, NUMBER)->value - 1;
-        obp_t newval = new_ldouble(value);
-        IS_INT(newval) = IS_INT(arg) && INTRANGE(value);
-        return newval;
+        CHECK_NUMBERS(1, argv);
+        return num_object(num_sub(num_of(argv[0]), num_int(1)));
 }
 
 
@@ -66,114 +323,75 @@ obp_t bf_predecessor(int nargs, obp_t args, session_context_t *sc, int level)
  * Return the numeric value of the first argument minus all others.
  * (- n1 [n2 ...])
  */
-obp_t bf_minus(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_minus(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t first = CAR(args);
-        CHECKTYPE_RET(sc->out, first, NUMBER);
-
-        long double value = AS(first, NUMBER)->value;
-        int is_int = 1;
-        args = CDR(args);
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                value -= AS(arg, NUMBER)->value;
-                is_int &= IS_INT(arg) && INTRANGE(value);
-                args = CDR(args);
+        CHECK_NUMBERS(argc, argv);
+        num_t value = num_of(argv[0]);
+        for (int i = 1; i < argc; i++) {
+                value = num_sub(value, num_of(argv[i]));
         }
-        obp_t newval = new_ldouble(value);
-        IS_INT(newval) = is_int;
-        return newval;
+        return num_object(value);
 }
 
 /**
  * Return the product of all arguments, which must be numbers.
  * (* [n1 ...])
  */
-obp_t bf_times(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_times(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        long double value = 1;
-        int is_int = 1;
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                value *= AS(arg, NUMBER)->value;
-                is_int &= IS_INT(arg) && INTRANGE(value);
-                args = CDR(args);
+        CHECK_NUMBERS(argc, argv);
+        num_t value = num_int(1);
+        for (int i = 0; i < argc; i++) {
+                value = num_mul(value, num_of(argv[i]));
         }
-        obp_t newval = new_ldouble(value);
-        IS_INT(newval) = is_int;
-        return newval;
+        return num_object(value);
 }
 
 /**
  * Return the numeric value of the first argument divided by all others.
  * (/ n1 [n2 ...])
  */
-obp_t bf_divide(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_divide(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t start = CAR(args);
-        CHECKTYPE_RET(sc->out, start, NUMBER);
-
-        long double value = AS(start, NUMBER)->value;
-        int is_int = 1;
-        args = CDR(args);
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                value /= AS(arg, NUMBER)->value;
-                is_int &= IS_INT(arg) && remainderl(value, 1.0) == 0;
-                args = CDR(args);
+        CHECK_NUMBERS(argc, argv);
+        num_t value = num_of(argv[0]);
+        for (int i = 1; i < argc; i++) {
+                if (divides_by_zero(value, argv[i])) {
+                        num_free(&value);
+                        return throw_error(sc->out, ERR_DIVZERO, argv[i],
+                                           "divisor");
+                }
+                value = num_div(value, num_of(argv[i]));
         }
-        obp_t newval = new_ldouble(value);
-        IS_INT(newval) = is_int;
-        return newval;
+        return num_object(value);
 }
 
 /**
  * Return the numeric value of the first argument modulo all others.
  * (% n1 [n2 ...])
  */
-obp_t bf_modulo(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_modulo(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t start = CAR(args);
-        CHECKTYPE_RET(sc->out, start, NUMBER);
-
-        long double value = AS(start, NUMBER)->value;
-        int is_int = 1;
-        args = CDR(args);
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                value = fmodl(value, AS(arg, NUMBER)->value);
-                is_int &= IS_INT(arg) && remainderl(value, 1.0) == 0;
-                args = CDR(args);
+        CHECK_NUMBERS(argc, argv);
+        num_t value = num_of(argv[0]);
+        for (int i = 1; i < argc; i++) {
+                if (divides_by_zero(value, argv[i])) {
+                        num_free(&value);
+                        return throw_error(sc->out, ERR_DIVZERO, argv[i],
+                                           "divisor");
+                }
+                value = num_mod(value, num_of(argv[i]));
         }
-        obp_t newval = new_ldouble(value);
-        IS_INT(newval) = is_int && remainderl(value, 1.0) == 0;
-        return newval;
+        return num_object(value);
 }
 
 /**
  * Return t iff all arguments, which must be numbers, have the same value.
  * (= n1 [n2 ...])
  */
-obp_t bf_equals(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_equals(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t start = CAR(args);
-        CHECKTYPE_RET(sc->out, start, NUMBER);
-
-        long value = AS(start, NUMBER)->value;
-        args = CDR(args);
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                if (value != AS(arg, NUMBER)->value) {
-                        return the_Nil;
-                }
-                args = CDR(args);
-        }
-        return the_T;
+        return compare_chain(argc, argv, sc, CMP_EQUAL);
 }
 
 /**
@@ -181,25 +399,9 @@ obp_t bf_equals(int nargs, obp_t args, session_context_t *sc, int level)
  * its right side.
  * (> n1 [n2 ...])
  */
-obp_t bf_greater(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_greater(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t start = CAR(args);
-        CHECKTYPE_RET(sc->out, start, NUMBER);
-
-        long double value = AS(start, NUMBER)->value;
-        args = CDR(args);
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                long newarg = AS(arg, NUMBER)->value;
-                //printf("%ld > %ld? %d\n", value, newarg, value > newarg);
-                if (!(value > newarg)) {
-                        return the_Nil;
-                }
-                value = newarg;
-                args = CDR(args);
-        }
-        return the_T;
+        return compare_chain(argc, argv, sc, CMP_GREATER);
 }
 
 
@@ -208,24 +410,9 @@ obp_t bf_greater(int nargs, obp_t args, session_context_t *sc, int level)
  * to the one on its right side.
  * (>= n1 [n2 ...])
  */
-obp_t bf_greatere(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_greatere(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t start = CAR(args);
-        CHECKTYPE_RET(sc->out, start, NUMBER);
-
-        long double value = AS(start, NUMBER)->value;
-        args = CDR(args);
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                int newarg = AS(arg, NUMBER)->value;
-                if (!(value >= newarg)) {
-                        return the_Nil;
-                }
-                value = newarg;
-                args = CDR(args);
-        }
-        return the_T;
+        return compare_chain(argc, argv, sc, CMP_GREATER | CMP_EQUAL);
 }
 
 
@@ -234,24 +421,9 @@ obp_t bf_greatere(int nargs, obp_t args, session_context_t *sc, int level)
  * its right side.
  * (< n1 [n2 ...])
  */
-obp_t bf_less(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_less(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t start = CAR(args);
-        CHECKTYPE_RET(sc->out, start, NUMBER);
-
-        long double value = AS(start, NUMBER)->value;
-        args = CDR(args);
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                int newarg = AS(arg, NUMBER)->value;
-                if (!(value < newarg)) {
-                        return the_Nil;
-                }
-                value = newarg;
-                args = CDR(args);
-        }
-        return the_T;
+        return compare_chain(argc, argv, sc, CMP_LESS);
 }
 
 /**
@@ -259,52 +431,38 @@ obp_t bf_less(int nargs, obp_t args, session_context_t *sc, int level)
  * the one on its right side.
  * (< n1 [n2 ...])
  */
-obp_t bf_lesse(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_lesse(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t start = CAR(args);
-        CHECKTYPE_RET(sc->out, start, NUMBER);
-
-        long double value = AS(start, NUMBER)->value;
-        args = CDR(args);
-        while (!IS_NIL(args)) {
-                obp_t arg = CAR(args);
-                CHECKTYPE_RET(sc->out, arg, NUMBER);
-                int newarg = AS(arg, NUMBER)->value;
-                if (!(value <= newarg)) {
-                        return the_Nil;
-                }
-                value = newarg;
-                args = CDR(args);
-        }
-        return the_T;
+        return compare_chain(argc, argv, sc, CMP_LESS | CMP_EQUAL);
 }
 
 /**
  * Return t iff the argument is equal to zero.
  * (zerop n1)
  */
-obp_t bf_zerop(int nargs, obp_t args, session_context_t *sc, int level)
+obp_t bf_zerop(int argc, obp_t *argv, session_context_t *sc, int level)
 {
-        obp_t arg = CAR(args);
-        CHECKTYPE_RET(sc->out, arg, NUMBER);
-        return (AS(arg, NUMBER)->value == 0 ? the_T : the_Nil);
+        obp_t arg = argv[0];
+        CHECK_NUMBERS(1, argv);
+        /* a bignum is never zero */
+        return (IS(arg, NUMBER) && DOUBLE_VALUE(arg) == 0 ? the_T : the_Nil);
 }
 
 
 
 void init_numbers(void)
 {
-        register_builtin(PLUS_NAME, bf_plus, 0, 0, -1);
-        register_builtin(MINUS_NAME, bf_minus, 0, 2, -1);
-        register_builtin(TIMES_NAME, bf_times, 0, 0, -1);
-        register_builtin(DIVIDE_NAME, bf_divide, 0, 2, -1);
-        register_builtin(MODULO_NAME, bf_modulo, 0, 2, -1);
-        register_builtin(EQUALS_NAME, bf_equals, 0, 2, -1);
-        register_builtin(GREATER_NAME, bf_greater, 0, 2, -1);
-        register_builtin(GREATERE_NAME, bf_greatere, 0, 2, -1);
-        register_builtin(LESS_NAME, bf_less, 0, 2, -1);
-        register_builtin(LESSE_NAME, bf_lesse, 0, 2, -1);
-        register_builtin(ZEROP_NAME, bf_zerop, 0, 1, 1);
-        register_builtin(SUCCESSOR_NAME, bf_successor, 0, 1, 1);
-        register_builtin(PREDECESSOR_NAME, bf_predecessor, 0, 1, 1);
+        register_builtin_argv(PLUS_NAME, bf_plus, 0, -1);
+        register_builtin_argv(MINUS_NAME, bf_minus, 2, -1);
+        register_builtin_argv(TIMES_NAME, bf_times, 0, -1);
+        register_builtin_argv(DIVIDE_NAME, bf_divide, 2, -1);
+        register_builtin_argv(MODULO_NAME, bf_modulo, 2, -1);
+        register_builtin_argv(EQUALS_NAME, bf_equals, 2, -1);
+        register_builtin_argv(GREATER_NAME, bf_greater, 2, -1);
+        register_builtin_argv(GREATERE_NAME, bf_greatere, 2, -1);
+        register_builtin_argv(LESS_NAME, bf_less, 2, -1);
+        register_builtin_argv(LESSE_NAME, bf_lesse, 2, -1);
+        register_builtin_argv(ZEROP_NAME, bf_zerop, 1, 1);
+        register_builtin_argv(SUCCESSOR_NAME, bf_successor, 1, 1);
+        register_builtin_argv(PREDECESSOR_NAME, bf_predecessor, 1, 1);
 }
@@ -3,8 +3,19 @@
  */
 
 #include "cbasics.h"
+#include <limits.h>
 
-#define IS_INT(ob) (((obp_t) ob)->num_is_int)
+#define IS_NUMBER(ob) (IS(ob, NUMBER) || IS(ob, BIGNUM))
+
+#define IS_INT(ob) (IS_FIXNUM(ob) || ((obp_t) (ob))->num_is_int)
+
+/* the value of an integer, immediate or not */
+#define INT_VALUE(ob) (IS_FIXNUM(ob) ? FIXNUM_VALUE(ob)                 \
+                       : AS(ob, NUMBER)->value.i)
+
+/* the value of any number as a double */
+#define DOUBLE_VALUE(ob) (IS_INT(ob) ? (double) INT_VALUE(ob)           \
+                          : AS(ob, NUMBER)->value.d)
 
 void init_numbers(void);
 
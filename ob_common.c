@@ -10,93 +10,85 @@
 #include "xmemory.h"
 #include "gc.h"
 
-/* The freelist array is indexed by object size in units of 8 bytes; obviously
- * the first two entries aren't used. The array should cover all common object
- * sizes; to find the best compromise will be a matter of optimization. For the
- * beginning, cover many and count them. Objects with a larger size will be
- * handled by malloc/free each time.
- */
-
-obp_t freelist[FREELIST_ENTRIES];
-long ob_sizecount[FREELIST_ENTRIES];    /* count objects per size */
-
-
 long object_count = 0;                  /* count of all objects ever created */
 
-obp_t alloced_obs;                      /* list of all objects not in the
-                                           freelist */
+specbinding_t *specpdl;                 /* the special binding stack */
+uint specpdl_top;                       /* index of the next free entry */
+uint specpdl_size;                      /* number of allocated entries */
 
-gcp_t pushdown_list;
 
+/* The stack grows by doubling and is never shrunk. */
+void specbind(obp_t symbol, obp_t value)
+{
+        Lsymbol_t *sym = AS(symbol, SYMBOL);
+
+        if (specpdl_top >= specpdl_size) {
+                specpdl_size = specpdl_size ? 2 * specpdl_size
+                                            : SPECPDL_INITIAL;
+                specpdl = xrealloc(specpdl,
+                                   specpdl_size * sizeof(specbinding_t),
+                                   "special binding stack");
+        }
+        specpdl[specpdl_top].symbol = symbol;
+        specpdl[specpdl_top].old_value = sym->value;
+        specpdl_top++;
+        sym->value = value;
+        gc_write_barrier(symbol, value);
+}
 
-void pushdown(obp_t value)
+obp_t specunbind(void)
 {
-        gcp_t entry = (gcp_t) new_object(sizeof(struct GCPROT), GCPROT);
-        entry->item.value = value;
-        entry->next = pushdown_list;
-        entry->is_obpp = 0;
-        pushdown_list = entry;
+        specbinding_t *b = &specpdl[--specpdl_top];
+        AS(b->symbol, SYMBOL)->value = b->old_value;
+        gc_write_barrier(b->symbol, b->old_value);
+        return b->symbol;
 }
 
-obp_t popup(void)
+void unbind_to(uint depth)
 {
-        gcp_t entry = pushdown_list;
-        pushdown_list = pushdown_list->next;
-        obp_t value = entry->item.value;
-        ob_free((obp_t) entry);
-        return value;
+        while (specpdl_top > depth) {
+                specunbind();
+        }
 }
 
 
 void ob_free(obp_t ob)
 {
-        int index = ob->size >> 3;
-
-        memset(ob, 0, ob->size);
-        ob->next = freelist[index];
-        freelist[index] = ob;
-        ob_sizecount[index]++;
+        heap_free(ob);
 }
 
 
 /**
- * Create a new object and register it so it gets included in the garbage
- * collection sweep.
+ * Create a new object in the heap, where the garbage collection sweep will
+ * find it.
  */
 obp_t new_object(uint size, int type)
 {
-        obp_t ob = 0;                   /* the object to be */
+        obp_t ob;                       /* the object to be */
 
-        if (object_count
-            && object_count % GC_OBJ_COUNT == 0
-            && type != GCPROT)
-        {
+        if (gc_marking) {
+                gc_step();
+        } else if (gc_alloc_bytes >= gc_trigger_bytes) {
                 gc();
         }
 
         if (size % OBSIZE_UNIT) {
                 size += OBSIZE_UNIT - (size % OBSIZE_UNIT);
         }
-        
-        if (size <= FREELIST_MAXSIZE) {
-                int index = size >> 3;
-                if (freelist[index]) {
-                        ob = freelist[index];
-                        freelist[index] = freelist[index]->next;
-                        ob_sizecount[index]--;
-                }
-        }
-        if (ob == 0) {
-                ob = xcalloc(1, size, "new object");
+        if (size < HEAP_MIN_SLOT) {
+                size = HEAP_MIN_SLOT;
         }
+        
+        ob = heap_alloc(size);
 
         object_count++;
+        gc_alloc_bytes += size;
         memset(ob, 0, size);
         assert(type);
         ob->type = type;
-        ob->size = size;
-        ob->next = alloced_obs;
-        alloced_obs = ob;
+        if (needs_finalize(type)) {
+                heap_set_finalize(ob);
+        }
 
         return ob;
 }
@@ -7,6 +7,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "objects.h"
 #include "xmemory.h"
 #include "hashmap.h"
@@ -14,6 +15,8 @@
 #include "io.h"
 #include "signals.h"
 #include "printer.h"
+#include "gc.h"
+#include "analyze.h"
 
 
 
@@ -28,6 +31,24 @@ obp_t the_T;                            /* the t symbol */
 
 obp_t the_Lambda;                       /* the lambda symbol */
 obp_t the_Mu;                           /* the mu symbol */
+obp_t the_Optional;                     /* lambda list keywords */
+obp_t the_Rest;
+obp_t the_Lexical_binding;              /* functions defined while its value
+                                           is non-nil are lexical */
+obp_t the_Quote;                        /* symbols used by the reader, */
+obp_t the_Quasiquote;
+obp_t the_Unquote;
+obp_t the_Splice;
+obp_t the_Function;
+obp_t the_Declare;                      /* in declarations, */
+obp_t the_Lexical;
+obp_t the_Special;
+obp_t the_Last_error;                   /* and by builtins */
+obp_t the_Usecs;
+obp_t the_Evals;
+obp_t the_Applys;
+obp_t the_Bindings;
+obp_t the_Objects;
 
 int traceflag;
 
@@ -44,7 +65,8 @@ obp_t all_symbols(void)
 typedef struct OBJ_OPS {
         void (*op_traverse)(obp_t, void (*do_func)(obp_t),
                             int (*stop_func)(obp_t));
-        void (*op_free)(obp_t ob);
+        void (*op_free)(obp_t ob);      /* free resources outside the heap;
+                                           0 if there are none */
 } obj_ops_t ;
 
 
@@ -54,6 +76,8 @@ typedef struct OBJ_OPS {
 void free_map(obp_t ob);
 void free_strbuf(obp_t ob);
 void free_port(obp_t ob);
+void free_vector(obp_t ob);
+void free_function(obp_t ob);
 
 void traverse_nop(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t));
 void traverse_symbol(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t));
@@ -62,7 +86,8 @@ void traverse_pair(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t));
 void traverse_vector(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t));
 void traverse_signal(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t));
 void traverse_func(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t));
-void traverse_gcprot(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t));
+void traverse_environ(obp_t ob, void (*do_func)(obp_t),
+                      int (*stop_func)(obp_t));
 
 obj_ops_t oops[] = {
         /* INVALiD */
@@ -73,27 +98,27 @@ obj_ops_t oops[] = {
         /* SYMBOL */
         {
                 traverse_symbol,
-                ob_free
+                0
         },
         /* PAIR */
         {
                 traverse_pair,
-                ob_free
+                0
         },
         /* NUMBER */
         {
                 traverse_nop,
-                ob_free
+                0
         },
         /* STRING */
         {
                 traverse_nop,
-                ob_free
+                0
         },
         /* CHAR */
         {
                 traverse_nop,
-                ob_free
+                0
         },
         /* PORT */
         {
@@ -103,7 +128,7 @@ obj_ops_t oops[] = {
         /* VECTOR */
         {
                 traverse_vector,
-                0
+                free_vector
         },
         /* MAP */
         {
@@ -128,16 +153,16 @@ obj_ops_t oops[] = {
         /* FUNCTION */
         {
                 traverse_func,
-                0
+                free_function
         },
         /* ENVIRON */
         {
-                0,
+                traverse_environ,
                 0
         },
-        /* GCPROT */
+        /* BIGNUM */
         {
-                traverse_gcprot,
+                traverse_nop,
                 0
         },
         /* SENTiNEL */
@@ -171,7 +196,7 @@ char *type_name(objtype_t type)
                 "STRBUF",
                 "FUNCTION",
                 "ENVIRON",
-                "GCPROT",
+                "BIGNUM",
                 "SENTiNEL"
         };
 
@@ -240,24 +265,32 @@ void traverse_func(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t))
             case F_FORM:
                 traverse_ob(func->impl.form, do_func, stop_func);
                 break;
+            case F_BYTECODE:
+                traverse_ob(func->impl.form, do_func, stop_func);
+                traverse_ob(func->code, do_func, stop_func);
+                break;
             default:                    /* nothing for the other type(s) */
                 break;
         }
+        traverse_ob(func->env, do_func, stop_func);
 }
 
-void traverse_gcprot(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t))
+void traverse_environ(obp_t ob, void (*do_func)(obp_t),
+                      int (*stop_func)(obp_t))
 {
-        gcp_t gcp = AS(ob, GCPROT);
-        if (gcp->is_obpp) {
-                traverse_ob(*gcp->item.obpp, do_func, stop_func);
-        } else {
-                traverse_ob(gcp->item.value, do_func, stop_func);
+        Lenviron_t *env = AS(ob, ENVIRON);
+        traverse_ob(env->parent, do_func, stop_func);
+        for (uint i = 0; i < env->nslots; i++) {
+                traverse_ob(env->slot[i], do_func, stop_func);
         }
 }
 
+/* Immediates are not in the heap and reference nothing, so they are not
+ * visited.
+ */
 void traverse_ob(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t))
 {
-        if (!ob || stop_func(ob)) {
+        if (!ob || IS_IMMEDIATE(ob) || stop_func(ob)) {
                 return;
         }
         if (traceflag) {
@@ -272,19 +305,43 @@ void traverse_ob(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t))
 }
 
 
+int needs_finalize(objtype_t type)
+{
+        return oops[type].op_free != 0;
+}
+
+
 void free_obj(obp_t ob)
 {
         uchar type = ob->type;
         assert(type > INVALiD && type < SENTiNEL);
-        oops[type].op_free(ob);
+        if (oops[type].op_free) {
+                oops[type].op_free(ob);
+        }
 }
 
 
+/* The finalizers run in the GC sweep and must not allocate objects, so errors
+ * are ignored here.
+ */
 void free_port(obp_t ob)
 {
-        port_flush(ob);
-        close_port(ob);
-        ob_free(ob);
+        Lport_t *p = AS(ob, PORT);
+        if (p->closed) {
+                return;
+        }
+        p->closed = 1;
+        switch (p->type) {
+            case STREAM_PORT:
+                fclose(p->port.stream);
+                break;
+            case FD_PORT:
+                close(p->port.fd);
+                break;
+            case STRING_PORT:
+                free(p->port.strbuf);
+                break;
+        }
 }
 
 
@@ -292,14 +349,27 @@ void free_map(obp_t ob)
 {
         Lmap_t *ob_map = AS(ob, MAP);
         hashmap_destroy(ob_map->map);
-        ob_free(ob);
 }
 
 void free_strbuf(obp_t ob)
 {
         Lstrbuf_t *ob_strbuf = AS(ob, STRBUF);
         xfree(ob_strbuf->strbuf);
-        ob_free(ob);
+}
+
+void free_vector(obp_t ob)
+{
+        Lvector_t *ob_vector = AS(ob, VECTOR);
+        xfree(ob_vector->elem);
+}
+
+void free_function(obp_t ob)
+{
+        Lfunction_t *func = AS(ob, FUNCTION);
+        if (func->tree) {
+                free_tree(func->tree);
+        }
+        xfree(func->params);
 }
 
 
@@ -316,19 +386,22 @@ static obp_t new_symbol(obp_t name)
                 printf("new symbol %*s\n", ob_name->length, ob_name->content);
         }
         hashmap_put(symbols_map, name, (obp_t) ob);
+        gc_write_barrier(symbols, name);
+        gc_write_barrier(symbols, (obp_t) ob);
         return (obp_t) ob;
 }
 
 
 /**
- * Get the symbol with the specified name. Is created if it does not exist.
+ * Get the symbol with the specified name. Is created if it does not exist;
+ * only then is a name string allocated.
  */
 obp_t intern(char *name, int namelen)
 {
-        obp_t s_name = new_string(name, namelen);
-        obp_t symbol = hashmap_get(symbols_map, s_name);
+        obp_t symbol = hashmap_get_string(symbols_map, name, namelen,
+                                          string_hash(name, namelen));
         if (!symbol) {
-                symbol = new_symbol(s_name);
+                symbol = new_symbol(new_string(name, namelen));
         }
         return symbol;
 }
@@ -352,23 +425,55 @@ obp_t new_pair(obp_t car, obp_t cdr)
 }
 
 
+obp_t new_environ(uint nslots, obp_t parent)
+{
+        uint size = sizeof(Lenviron_t);
+
+        if (nslots > 1) {
+                size += (nslots - 1) * sizeof(obp_t);
+        }
+        Lenviron_t *ob = NEW_OBJ2(ENVIRON, size);
+        ob->parent = parent;
+        ob->nslots = nslots;
+        for (uint i = 0; i < nslots; i++) {
+                ob->slot[i] = the_Nil;
+        }
+        return (obp_t) ob;
+}
+
+
 obp_t new_integer(long value)
 {
+        if (FIXNUM_RANGE(value)) {
+                return MAKE_FIXNUM(value);
+        }
         Lnumber_t *ob = NEW_OBJ(NUMBER);
-        ob->value = value;
+        ob->value.i = value;
         ob->obj.eq_is_eqv = 1;
-        IS_INT(ob) = 1;
+        ob->obj.num_is_int = 1;
         return (obp_t) ob;
 }
 
-obp_t new_ldouble(long double value)
+obp_t new_double(double value)
 {
         Lnumber_t *ob = NEW_OBJ(NUMBER);
-        ob->value = value;
+        ob->value.d = value;
         ob->obj.eq_is_eqv = 1;
         return (obp_t) ob;
 }
 
+/* the digits are zero */
+obp_t new_bignum(uint ndigits, int negative)
+{
+        Lbignum_t *ob = NEW_OBJ2(BIGNUM, sizeof(Lbignum_t)
+                                 + (ndigits - 1) * sizeof(uint32_t));
+        ob->ndigits = ndigits;
+        ob->negative = negative != 0;
+        ob->obj.eq_is_eqv = 1;
+        ob->obj.num_is_int = 1;
+        return (obp_t) ob;
+}
+
 obp_t new_string(char *content, uint length)
 {
         Lstring_t *ob = NEW_OBJ2(STRING, sizeof(Lstring_t) + length);
@@ -395,9 +500,7 @@ obp_t new_zstring(char *zero_terminated_string)
 
 obp_t new_char(int content)
 {
-        Lchar_t *ob = NEW_OBJ(CHAR);
-        ob->value = content;
-        return (obp_t) ob;
+        return MAKE_CHAR(content);
 }
 
 obp_t new_port(char *name, FILE *stream, int fd, strbuf_t sb,
@@ -462,6 +565,25 @@ void init_objects(void)
         
         the_Lambda = intern_z(LAMBDA_NAME);
         the_Mu = intern_z(SPECIAL_NAME);
+        the_Optional = intern_z(OPTIONAL_NAME);
+        the_Rest = intern_z(REST_NAME);
+        the_Lexical_binding = intern_z(LEXICAL_BINDING_NAME);
+        AS(the_Lexical_binding, SYMBOL)->value = the_Nil;
+
+        the_Quote = intern_z(QUOTE_NAME);
+        the_Quasiquote = intern_z(QUASIQUOTE_NAME);
+        the_Unquote = intern_z(UNQUOTE_NAME);
+        the_Splice = intern_z(SPLICE_NAME);
+        the_Function = intern_z(FUNCTION_NAME);
+        the_Declare = intern_z(DECLARE_NAME);
+        the_Lexical = intern_z(LEXICAL_NAME);
+        the_Special = intern_z(SPECIAL_DECL_NAME);
+        the_Last_error = intern_z(LAST_ERROR_NAME);
+        the_Usecs = intern_z(USECS_NAME);
+        the_Evals = intern_z(EVALS_NAME);
+        the_Applys = intern_z(APPLYS_NAME);
+        the_Bindings = intern_z(BINDINGS_NAME);
+        the_Objects = intern_z(OBJECTS_NAME);
 }
 
 
@@ -13,14 +13,17 @@
 #include <netdb.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 
 #include "builtins.h"
 #include "numbers.h"
 #include "strbuf.h"
 #include "session.h"
+#include "heap.h"
 
 /*
- * definitions for freelist management, see ob_common.c
+ * definitions for the heap size classes, see heap.c
  */
 #define OBSIZE_UNIT        8
 #define FREELIST_ENTRIES 131            /* for strings up to 1K */
@@ -45,8 +48,7 @@ typedef enum {
         FUNCTION,                       /* a function or special form, builtin
                                            or lambda/mu */
         ENVIRON,                        /* environment */
-        GCPROT,                         /* GC protection entry, not
-                                           Lisp-visible */
+        BIGNUM,                         /* integer too large for a long */
         SENTiNEL                        /* also invalId */
 } objtype_t;
 
@@ -61,12 +63,9 @@ typedef enum {
  * will be contained in the beginning of each instantiable object struct.
  *
  */
-typedef struct OBJECT {                 /* the object in general */
-        struct OBJECT *next;            /* linkage in allocated and free
-                                           lists */
-        uint size;                      /* length of the actual object */
+typedef struct OBJECT {                 /* the object in general; the size is
+                                           kept in the heap page, see heap.h */
         uchar type;                     /* 256 should be enough for everyone. */
-        uint mark:1;                    /* for GC and things */
         uint eq_is_eqv:1;               /* may be eq even if not same */
         uint immutable:1;               /* immutable if non-zero; we want this
                                            e. g. for the stdin/out/err file
@@ -74,7 +73,47 @@ typedef struct OBJECT {                 /* the object in general */
         uint num_is_int:1;              /* 1 if number is actually an integer */
 } Lobject_t;
 
-#define IS(obj, obtype) (obj->type == obtype)
+/*
+ * Small integers and characters are not allocated, but carried in the object
+ * pointer itself. A heap object is aligned to OBSIZE_UNIT, so its pointer has
+ * the low bits clear. A fixnum has the lowest bit set and its value in the
+ * other bits; a character has IMM_CHAR in the lowest two bits and its code
+ * (or EOF) above. Immediates must not be dereferenced, so code that looks
+ * into an object that may be one must use IS() or type_of() first.
+ */
+#define IMM_FIXNUM 1
+#define IMM_CHAR 2
+#define IMM_MASK 3
+
+#define IS_IMMEDIATE(ob) (((uintptr_t) (ob) & IMM_MASK) != 0)
+#define IS_FIXNUM(ob) (((uintptr_t) (ob) & IMM_FIXNUM) != 0)
+#define IS_IMMCHAR(ob) (((uintptr_t) (ob) & IMM_MASK) == IMM_CHAR)
+
+#define FIXNUM_MIN (LONG_MIN >> 1)
+#define FIXNUM_MAX (LONG_MAX >> 1)
+#define FIXNUM_RANGE(value) ((value) >= FIXNUM_MIN && (value) <= FIXNUM_MAX)
+#define MAKE_FIXNUM(value)                                              \
+        ((obp_t) (((uintptr_t) (long) (value) << 1) | IMM_FIXNUM))
+#define FIXNUM_VALUE(ob) ((long) ((intptr_t) (ob) >> 1))
+
+#define MAKE_CHAR(c) ((obp_t) (((uintptr_t) (intptr_t) (c) << 2) | IMM_CHAR))
+#define CHAR_VALUE(ob) ((int) ((intptr_t) (ob) >> 2))
+
+/**
+ * Return the type of an object, immediate or not.
+ */
+static inline objtype_t type_of(obp_t ob)
+{
+        if (IS_FIXNUM(ob)) {
+                return NUMBER;
+        }
+        if (IS_IMMCHAR(ob)) {
+                return CHAR;
+        }
+        return ob->type;
+}
+
+#define IS(obj, obtype) (type_of(obj) == (obtype))
 #define AS(obj, obtype) (assert(IS(obj, obtype)), (struct obtype *) obj)
 
 #define IS_NIL(ob) (ob == the_Nil)
@@ -84,7 +123,10 @@ typedef struct OBJECT {                 /* the object in general */
 #define IS_FORM(ob) (IS(ob, FUNCTION) && AS(ob, FUNCTION)->type == F_FORM)
 #define IS_AUTOLOAD(ob) (IS(ob, FUNCTION) &&                    \
                          AS(ob, FUNCTION)->type == F_AUTOLOAD)
+#define IS_BYTECODE(ob) (IS(ob, FUNCTION) &&                    \
+                         AS(ob, FUNCTION)->type == F_BYTECODE)
 #define IS_SPECIAL(ob) (IS(ob, FUNCTION) && AS(ob, FUNCTION)->is_special)
+#define IS_MACRO(ob) (IS(ob, FUNCTION) && AS(ob, FUNCTION)->is_macro)
 
 #define CAR(o) (AS(o, PAIR)->car)
 #define CDR(o) (AS(o, PAIR)->cdr)
@@ -92,9 +134,10 @@ typedef struct OBJECT {                 /* the object in general */
 #define CADDR(o) CAR(CDR(CDR(o)))
 #define CADDDR(o) CAR(CDR(CDR(CDR(o))))
 
-#define NEW_OBJ(obtype) AS(new_object(sizeof(struct obtype), obtype), \
-                               obtype)
-#define NEW_OBJ2(obtype, length) AS(new_object(length, obtype), obtype)
+/* not via AS(), which would evaluate new_object() twice */
+#define NEW_OBJ(obtype) ((struct obtype *) new_object(sizeof(struct obtype), \
+                                                      obtype))
+#define NEW_OBJ2(obtype, length) ((struct obtype *) new_object(length, obtype))
 
 #define THE_STRINGS(ob) AS(ob, STRING)->content, AS(ob, STRING)->length
 #define THE_STRINGL(ob) AS(ob, STRING)->length, AS(ob, STRING)->content
@@ -135,23 +178,37 @@ typedef struct PAIR {                   /* a cons cell */
 
 typedef struct NUMBER {                 /* a number of any type */
         Lobject_t obj;
-        long double value;              /* will be something else some day */
+        uint hash;                      /* cached hash code, 0 if not yet
+                                           computed, see hashmap.c */
+        union {
+                long i;                 /* if obj.num_is_int is set */
+                double d;
+        } value;
 } Lnumber_t;
 
 
+typedef struct BIGNUM {                 /* an integer too large for a long,
+                                           see bignum.c */
+        Lobject_t obj;
+        uint ndigits;                   /* number of digits, the top one
+                                           non-zero */
+        uint negative:1;
+        uint hash;                      /* cached hash code or 0 */
+        uint32_t digit[1];              /* 32-bit digits of the magnitude,
+                                           least significant first */
+} Lbignum_t;
+
+
 typedef struct STRING {                 /* a string, immutable */
         Lobject_t obj;
         uint length;                    /* may be huge, perhaps even ulong */
+        uint hash;                      /* cached hash code or 0 */
         char content[1];                /* zero-terminated *plus*
                                            length-controlled */
 } Lstring_t;
 
-#define IS_EOF(ob) (IS(ob, CHAR) && AS(ob, CHAR)->value == EOF)
-
-typedef struct CHAR {
-        Lobject_t obj;
-        int value;                      /* yep, this may be very wide */
-} Lchar_t;
+/* characters are always immediate, see MAKE_CHAR() */
+#define IS_EOF(ob) ((ob) == MAKE_CHAR(EOF))
 
 
 typedef enum { STREAM_PORT, FD_PORT, STRING_PORT } port_type_t;
@@ -213,16 +270,46 @@ typedef struct STRBUF {                 /* an expandable string buffer */
         strbuf_t strbuf;
 } Lstrbuf_t;
 
+/* A parameter in a lambda list. The objects are parts of the lambda form,
+ * which the function keeps alive.
+ */
+typedef struct PARAM {
+        obp_t symbol;
+        obp_t init;                     /* default value form of an optional
+                                           parameter, or 0 */
+} param_t;
+
+/* The lambda list of a lambda or mu function, parsed once by
+ * make_function(): the required parameters, then the &optional ones, then
+ * the &rest parameter, if there is one.
+ */
+typedef struct LAMBDA_LIST {
+        unsigned short nreq;            /* number of required parameters */
+        unsigned short nopt;            /* number of optional parameters */
+        unsigned short rest;            /* 1 if there is a rest parameter */
+        param_t param[];
+} lambda_list_t;
+
 typedef struct FUNCTION {
         Lobject_t obj;
         union {
                 builtin_func_t *builtin; /* the C function */
+                builtin_argv_t *builtin_argv; /* the same taking an argument
+                                                 vector */
                 obp_t form;             /* lambda or mu form; pre-checked for
                                            being a proper function, so we need
                                            not check it any more on
-                                           application */
+                                           application; also kept for
+                                           bytecode functions */
                 obp_t filename;         /* for autoload */
         } impl;
+        obp_t code;                     /* code vector of a bytecode function,
+                                           see bytecode.c, or the forms of the
+                                           analyzed body, see analyze.c */
+        struct NODE *tree;              /* analyzed body, or 0 */
+        lambda_list_t *params;          /* parsed lambda list, or 0 */
+        obp_t env;                      /* lexical frame a closure was made
+                                           in, or 0 */
         char *name;                     /* maybe undefined for lambdas */
         uint namelen;   
         short minargs;                  /* minimum number of arguments */
@@ -231,36 +318,42 @@ typedef struct FUNCTION {
         uchar type;                     /* F_BUILTIN, F_FORM, ... */
         uint is_special:1;              /* special form if non-zero */
         uint trace:1;                   /* trace this function */
+        uint argv:1;                    /* builtin takes an argument vector */
+        uint lexical:1;                 /* body analyzed with lexical
+                                           variables, see analyze.c */
+        uint is_macro:1;                /* special form returning its
+                                           expansion, see eval_macro() */
 } Lfunction_t;
 
-typedef struct ENVIRON {
+typedef struct ENVIRON {                /* a frame of lexical variables */
         Lobject_t obj;
-        hashmap_t map;                  /* the current symbol map */
-        struct ENVIRON *parent;         /* the parent environment */
+        obp_t parent;                   /* the enclosing frame, or 0 */
+        uint nslots;                    /* number of variables */
+        obp_t slot[1];                  /* their values */
 } Lenviron_t;
 
-typedef struct GCPROT {
-        Lobject_t obj;
-        union {
-                obp_t *obpp;            /* for GC protect list */
-                obp_t value;            /* for bindings pushdown list */
-        } item;
-        struct GCPROT *next;            /* next entry in GC protect list */
-        uint is_obpp:1;                 /* obpp is used, not value */
-} *gcp_t;
+/* An entry of the special binding stack: a bound symbol and the value it had
+ * before. Not an object; the live part of the stack is scanned by the GC.
+ */
+typedef struct SPECBINDING {
+        obp_t symbol;
+        obp_t old_value;
+} specbinding_t;
 
 obp_t new_object(uint size, int type);
 #define cons new_pair
 obp_t new_pair(obp_t car, obp_t cdr);
 #define new_pair0() new_pair(the_Nil, the_Nil)
 obp_t new_integer(long value);
-obp_t new_ldouble(long double value);
+obp_t new_double(double value);
+obp_t new_bignum(uint ndigits, int negative);
 obp_t new_string(char *content, uint length);
 obp_t new_zstring(char *zero_terminated_string);
 obp_t new_char(int content);
 obp_t new_port(char *name, FILE *stream, int fd, strbuf_t sb,
                port_type_t type, uint in, uint out);
 obp_t new_vector(uint nelem);
+obp_t new_environ(uint nslots, obp_t parent);
 obp_t new_map(eq_type_t eq_type, int weak_keyref);
 obp_t new_netaddr(struct addrinfo *ai);
 obp_t new_strbuf(char *content, uint length);
@@ -301,10 +394,37 @@ obp_t intern_z(char *name);
  */
 obp_t Loblist(void);
 
-void pushdown(obp_t value);
-obp_t popup(void);
+/**
+ * Bind a symbol to a new value, saving the old one on the special binding
+ * stack.
+ */
+void specbind(obp_t symbol, obp_t value);
+
+/**
+ * Undo the most recent binding on the special binding stack and return the
+ * symbol that was unbound.
+ */
+obp_t specunbind(void);
+
+/**
+ * Undo all bindings made since the special binding stack had the specified
+ * depth.
+ */
+void unbind_to(uint depth);
+
 void ob_free(obp_t ob);
 
+/**
+ * Return non-zero iff objects of the type hold resources outside the heap that
+ * must be freed by free_obj() when the object is collected.
+ */
+int needs_finalize(objtype_t type);
+
+/**
+ * Free the resources an object holds outside the heap.
+ */
+void free_obj(obp_t ob);
+
 void traverse_ob(obp_t ob, void (*do_func)(obp_t), int (*stop_func)(obp_t));
 
 
@@ -318,8 +438,25 @@ extern obp_t the_Nil;
 extern obp_t the_T;
 extern obp_t the_Lambda;
 extern obp_t the_Mu;
-extern gcp_t pushdown_list;
-extern obp_t alloced_obs;               /* all objects not in a free list */
+extern obp_t the_Optional;
+extern obp_t the_Rest;
+extern obp_t the_Lexical_binding;
+extern obp_t the_Quote;
+extern obp_t the_Quasiquote;
+extern obp_t the_Unquote;
+extern obp_t the_Splice;
+extern obp_t the_Function;
+extern obp_t the_Declare;
+extern obp_t the_Lexical;
+extern obp_t the_Special;
+extern obp_t the_Last_error;
+extern obp_t the_Usecs;
+extern obp_t the_Evals;
+extern obp_t the_Applys;
+extern obp_t the_Bindings;
+extern obp_t the_Objects;
+extern specbinding_t *specpdl;         /* the special binding stack */
+extern uint specpdl_top;                /* its current depth */
 
 extern int traceflag;
 extern long object_count;
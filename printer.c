@@ -10,6 +10,7 @@
 #include "xmemory.h"
 #include "io.h"
 #include "functions.h"
+#include "bignum.h"
 #include "math.h"
 
 
@@ -43,7 +44,7 @@ strbuf_t s_strbuf(obp_t ob, strbuf_t sb, int flags);
 strbuf_t s_signal(obp_t ob, strbuf_t sb, int flags);
 strbuf_t s_function(obp_t ob, strbuf_t sb, int flags);
 strbuf_t s_environ(obp_t ob, strbuf_t sb, int flags);
-strbuf_t s_gcprot(obp_t ob, strbuf_t sb, int flags);
+strbuf_t s_bignum(obp_t ob, strbuf_t sb, int flags);
 
 char tmp_buf[128];                      /* temporary print buffer, will be
                                          * overwritten by something else
@@ -66,7 +67,7 @@ stringer_t stringers[] = {
         s_strbuf,                       /* STRBUF */
         s_function,                     /* FUNCTION */
         s_environ,                      /* ENVIRON */
-        s_gcprot,                       /* GCPROT */
+        s_bignum,                       /* BIGNUM */
         0                               /* SENTiNEL */
 };
 
@@ -153,9 +154,13 @@ strbuf_t s_pair(obp_t ob, strbuf_t sb, int flags)
 strbuf_t s_number(obp_t ob, strbuf_t sb, int flags)
 {
         if (IS_INT(ob)) {
-                sprintf(tmp_buf, "%ld", lrint(AS(ob, NUMBER)->value));
+                sprintf(tmp_buf, "%ld", INT_VALUE(ob));
         } else {
-                sprintf(tmp_buf, "%Lg", AS(ob, NUMBER)->value);
+                sprintf(tmp_buf, "%g", AS(ob, NUMBER)->value.d);
+                /* a float with an integral value is not printed as int */
+                if (!tmp_buf[strspn(tmp_buf, "-0123456789")]) {
+                        strcat(tmp_buf, ".0");
+                }
         }
         return strbuf_append(sb, tmp_buf);
 }
@@ -175,7 +180,7 @@ strbuf_t s_string(obp_t ob, strbuf_t sb, int flags)
 
 strbuf_t s_char(obp_t ob, strbuf_t sb, int flags)
 {
-        char c = (char) AS(ob, CHAR)->value;
+        char c = (char) CHAR_VALUE(ob);
         if (flags & TOSTRING_READ) {
                 return quote_c(sb, c);
         } else {
@@ -289,7 +294,9 @@ strbuf_t s_function(obp_t ob, strbuf_t sb, int flags)
         Lfunction_t *func = AS(ob, FUNCTION);
         sb = strbuf_append(sb, "#<");
         sb = strbuf_append(sb, functype_name[func->type]);
-        if (func->is_special) {
+        if (func->is_macro) {
+                sb = strbuf_append(sb, "_m");
+        } else if (func->is_special) {
                 sb = strbuf_append(sb, "_s");
         }
         if (func->name) {
@@ -313,18 +320,16 @@ strbuf_t s_environ(obp_t ob, strbuf_t sb, int flags)
         return strbuf_append(sb, tmp_buf);
 }
 
-strbuf_t s_gcprot(obp_t ob, strbuf_t sb, int flags)
+strbuf_t s_bignum(obp_t ob, strbuf_t sb, int flags)
 {
-        gcp_t ob_gcprot = AS(ob, GCPROT);
-        sprintf(tmp_buf, "#<gcprot:%p>", ob_gcprot);
-        return strbuf_append(sb, tmp_buf);
+        return big_to_decimal(sb, ob);
 }
 
 
 strbuf_t s_expr(obp_t ob, strbuf_t sb, int flags)
 {
         if (ob) {
-                return stringers[ob->type](ob, sb, flags);
+                return stringers[type_of(ob)](ob, sb, flags);
         } else {
                 return strbuf_append(sb, "#<undef>");
         }
@@ -396,9 +401,16 @@ strbuf_t describe_ob(obp_t ob, strbuf_t sb)
         if (ob == 0) {
                 return strbuf_append(sb, UNBOUND_VALUE_NAME "\n");
         }
+        if (IS_IMMEDIATE(ob)) {
+                sprintf(tmp_buf, "ob %p immediate %s: ", ob,
+                        type_name(type_of(ob)));
+                sb = strbuf_append(sb, tmp_buf);
+                sb = s_expr(ob, sb, TOSTRING_READ);
+                return strbuf_addc(sb, '\n');
+        }
         sprintf(tmp_buf, "ob %p type %d %s mark %d eq %d r/o %d size %d int %d: ",
-               ob, ob->type, type_name(ob->type), ob->mark,
-                ob->eq_is_eqv, ob->immutable, ob->size, ob->num_is_int);
+               ob, ob->type, type_name(ob->type), heap_marked(ob),
+                ob->eq_is_eqv, ob->immutable, OB_SIZE(ob), ob->num_is_int);
         sb = strbuf_append(sb, tmp_buf);
         sb = s_expr(ob, sb, TOSTRING_READ);
         sb = strbuf_addc(sb, '\n');
@@ -416,7 +428,7 @@ strbuf_t describe_ob(obp_t ob, strbuf_t sb)
                             TOSTRING_READ | TOSTRING_PRINT);
                 sb = strbuf_addc(sb, '\n');
         }
-        xdump(stdout, ob, ob->size);
+        xdump(stdout, ob, OB_SIZE(ob));
         return sb;
 }
 
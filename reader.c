@@ -18,6 +18,7 @@
 #include "reader.h"
 #include "xmemory.h"
 #include "gc.h"
+#include "bignum.h"
 #include "math.h"
 
 
@@ -284,17 +285,22 @@ token_t make_atom(l_state_t state, session_context_t *sc)
                                             "%s:%d:%d: invalid char constant",
                                             sc->name, sc->lineno, sc->column);
                         AS(sc->tok_atom, SIGNAL)->data = new_string(s, len);
+                        gc_write_barrier(sc->tok_atom,
+                                         AS(sc->tok_atom, SIGNAL)->data);
                         return T_LERROR;
                 }
         } else {
                 char *end;
-                long double value = strtold(s, &end);
+                errno = 0;
+                long ivalue = strtol(s, &end, 10);
                 if (end - s == len) {
-                        if (remainderl(value, 1) == 0) {
-                                sc->tok_atom = new_integer((long) value);
-                        } else {
-                                sc->tok_atom = new_ldouble(value);
-                        }
+                        sc->tok_atom = errno == ERANGE ? big_read(s, len)
+                                : new_integer(ivalue);
+                        return T_ISATOM;
+                }
+                double value = strtod(s, &end);
+                if (end - s == len) {
+                        sc->tok_atom = new_double(value);
                         return T_ISATOM;
                 }
                 sc->tok_atom = intern(s, len);
@@ -354,7 +360,7 @@ token_t read_next_token(session_context_t *sc)
                 if (IS_EOF(ch)) {
                         c = EOF;
                 } else {
-                        c = AS(ch, CHAR)->value;
+                        c = CHAR_VALUE(ch);
                 }
                 
                 cclass_t class = charclass(c, sc);
@@ -414,7 +420,7 @@ token_t read_next_token(session_context_t *sc)
 typedef enum R_STATE { r_initial } r_state_t;
 
 
-obp_t do_special(char *name, session_context_t *sc)
+obp_t do_special(obp_t symbol, session_context_t *sc)
 {
         PROTECT;
         PROTVAR(arg);
@@ -428,7 +434,7 @@ obp_t do_special(char *name, session_context_t *sc)
                       sc->name, sc->lineno, sc->column);
         }
         argpair = new_pair(arg, the_Nil);
-        retval = new_pair(intern_z(name), argpair);
+        retval = new_pair(symbol, argpair);
     EXIT:
         UNPROTECT;
         return retval;
@@ -467,6 +473,7 @@ obp_t read_loop(token_t end_token, uint *n_exprs, session_context_t *sc)
                         expr = read_expr(sc);
                         CHECK_ERROR(expr);
                         CDR(last) = expr;
+                        gc_write_barrier(last, expr);
                         /* now we need the closing paren */
                         token = read_next_token(sc);
                         if (token != T_CPAREN) {
@@ -485,6 +492,7 @@ obp_t read_loop(token_t end_token, uint *n_exprs, session_context_t *sc)
                         retval = pair;
                 } else {
                         CDR(last) = pair;
+                        gc_write_barrier(last, pair);
                 }
                 last = pair;
                 n++;
@@ -502,7 +510,9 @@ obp_t reader_macro(session_context_t *sc)
         PROTVAR(retval);
         
         switch (nextt) {
-            case T_SQUOTE: return do_special(FUNCTION_NAME, sc);
+            case T_SQUOTE:
+                retval = do_special(the_Function, sc);
+                break;
                 /* others to follow here */
             case T_ENDOFF: ERROR(sc->out, ERR_RSYNTAX, 0,
                                  "%s:%d:%d: unexpected eof",
@@ -549,6 +559,8 @@ obp_t read_expr(session_context_t *sc)
                 while (kvpairs != the_Nil) {
                         first = CAR(kvpairs);
                         hashmap_put(hashmap, CAR(first), CDR(first));
+                        gc_write_barrier(map, CAR(first));
+                        gc_write_barrier(map, CDR(first));
                         kvpairs = CDR(kvpairs);
                 }
                 retval = map;
@@ -572,16 +584,16 @@ obp_t read_expr(session_context_t *sc)
                       "%s:%d:%d: unexpected close bracket",
                       sc->name, sc->lineno, sc->column);
             case T_SQUOTE:
-                retval = do_special(QUOTE_NAME, sc);
+                retval = do_special(the_Quote, sc);
                 break;
             case T_QQUOTE:
-                retval = do_special(QUASIQUOTE_NAME, sc);
+                retval = do_special(the_Quasiquote, sc);
                 break;
             case T_UNQUOT:
-                retval = do_special(UNQUOTE_NAME, sc);
+                retval = do_special(the_Unquote, sc);
                 break;
             case T_SPLICE:
-                retval = do_special(SPLICE_NAME, sc);
+                retval = do_special(the_Splice, sc);
                 break;
             case T_PERIOD:
                 ERROR(sc->out, ERR_RSYNTAX, 0, "unexpected period");
@@ -8,6 +8,7 @@
 #include "io.h"
 #include "printer.h"
 #include "names.h"
+#include "gc.h"
 
 
 obp_t new_signal(short type, short code, obp_t data, obp_t message)
@@ -25,14 +26,18 @@ obp_t throw_error(obp_t out_port, short code, obp_t ob, char *format, ...)
 {
         va_list arglist;
 
+        PROTECT;
+        protect(ob);
         va_start(arglist, format);
-        obp_t port = port_vprintf(make_string_port("error"), format, arglist);
-        obp_t errstr = get_port_string(port);
-        obp_t error = new_signal(SIG_LERROR, code, ob, errstr);
+        PROTVAL(port, port_vprintf(make_string_port("error"), format, arglist));
+        PROTVAL(errstr, get_port_string(port));
+        PROTVAL(error, new_signal(SIG_LERROR, code, ob, errstr));
         va_end(arglist);
-        AS(intern_z(LAST_ERROR_NAME), SYMBOL)->value =
-                new_signal(SIG_UERROR, code, ob, errstr);
+        obp_t last_error = new_signal(SIG_UERROR, code, ob, errstr);
+        AS(the_Last_error, SYMBOL)->value = last_error;
+        gc_write_barrier(the_Last_error, last_error);
         print_error(error, out_port);
+        UNPROTECT;
         return error;
 }
 
@@ -69,6 +74,8 @@ char *error_string(int errtype)
             case ERR_LETARGS:  return "invalid let arguments list";
             case ERR_IMMUTBL:  return "object is immutable";
             case ERR_NOAUTOL:  return "autoload failed to define function";
+            case ERR_DEPTH:    return "calls nested too deeply";
+            case ERR_DIVZERO:  return "division by zero";
             default: return "unknown error??";
         }
 }
@@ -25,6 +25,8 @@
 #define ERR_LETARGS       14            /* invalid let argument list */
 #define ERR_IMMUTBL       15            /* value may not be changed */
 #define ERR_NOAUTOL       16            /* autoload failed to define function */
+#define ERR_DEPTH         17            /* calls nested too deeply */
+#define ERR_DIVZERO       18            /* integer division by zero */
 
 #define IS_EXIT(o) (o && IS(o, SIGNAL) &&               \
                     (AS(o, SIGNAL)->type == SIG_LERROR  \
@@ -149,7 +149,7 @@ strbuf_t strbuf_nappend(strbuf_t sb, char *s, int slen)
                 sb = newsb;
                 sb->size = newsize;
         }
-        memmove(sb->s + sb->used, s, slen + 1);
+        memmove(sb->s + sb->used, s, slen);
         sb->used += slen;
         sb->s[sb->used] = 0;
         return sb;
@@ -3,10 +3,92 @@
  */
 
 /**
- * For the moment the garbage collector is simply called after the allocation of
- * so many objects.
+ * A collection is due when the bytes allocated since the last one reach
+ * (GC_GROWTH - 1) times the bytes that survived it, but not before GC_MIN_BYTES
+ * have been allocated. The growth factor may be changed on startup (see
+ * main.c) and at runtime with (gc-growth).
  */
-#define GC_OBJ_COUNT 10000
+#define GC_GROWTH 2.0
+#define GC_MIN_BYTES (256 * 1024)
+
+/**
+ * Size of a heap page, which holds objects of a single size class. Must be a
+ * power of two; pages are aligned to their size.
+ */
+#define HEAP_PAGE_SIZE (64 * 1024)
+
+/**
+ * A major collection is done when the old generation has grown to this many
+ * times the size it had after the last major collection.
+ */
+#define GC_MAJOR_FACTOR 2
+
+/**
+ * In incremental mode, a slice of marking is done every GC_SLICE_INTERVAL
+ * allocations, scanning up to GC_SLICE_WORK objects (unless a time budget is
+ * set, see main.c).
+ */
+#define GC_SLICE_INTERVAL 100
+#define GC_SLICE_WORK 1000
+
+/**
+ * Number of threads marking in parallel in a stop-the-world collection; may be
+ * changed on startup, see main.c.
+ */
+#define GC_THREADS 1
+
+/**
+ * Initial number of slots in the GC root stack; it is doubled as needed.
+ */
+#define GC_ROOTS_INITIAL 1024
+
+/**
+ * Initial number of entries in the GC mark stack; it is doubled as needed.
+ */
+#define MARK_STACK_INITIAL 4096
+
+/**
+ * Initial number of entries in the special binding stack; it is doubled as
+ * needed.
+ */
+#define SPECPDL_INITIAL 256
+
+/**
+ * Initial number of entries in the value stack, which holds the arguments of
+ * builtins and the values of bytecode functions; it is doubled as needed.
+ */
+#define VALUE_STACK_INITIAL 1024
+
+/**
+ * Maximum nesting depth of function calls; a deeper call is an error. May be
+ * changed on startup (see main.c) and at runtime with (max-depth). Calls are
+ * also an error when less than C_STACK_RESERVE bytes of the C stack are left.
+ */
+#define MAX_DEPTH 100000
+#define C_STACK_RESERVE (256 * 1024)
+
+/**
+ * Initial number of frames in the frame stack of the bytecode VM; it is
+ * doubled as needed.
+ */
+#define VM_FRAMES_INITIAL 256
+
+/**
+ * Number of slots in the cache of functions made from lambda and mu forms at
+ * the head of a call, see eval.c.
+ */
+#define LAMBDA_CACHE_SIZE 256
+
+/**
+ * Number of slots in the cache of macro expansions, see eval.c.
+ */
+#define MACRO_CACHE_SIZE 1024
+
+/**
+ * Number of digits (of 32 bits) of the smaller factor from which bignums are
+ * multiplied with Karatsuba's method instead of the school method.
+ */
+#define BIGNUM_KARATSUBA_DIGITS 32
 
 /**
  * Maximum length of the bucket lists in the hashmap. The map will be expanded
@@ -5,6 +5,7 @@
 #include <string.h>
 #include "objects.h"
 #include "xmemory.h"
+#include "gc.h"
 
 static void v_realloc(Lvector_t *v, uint newsize)
 {
@@ -29,6 +30,7 @@ obp_t vector_append(obp_t ob, obp_t new_elem)
                 v_realloc(vec, MIN(vec->allocated * 2, 1));
         }
         vec->elem[++vec->nelem] = new_elem;
+        gc_write_barrier(ob, new_elem);
         return ob;
 }
 
@@ -44,6 +46,7 @@ obp_t vector_put(obp_t ob, obp_t new_elem, uint slot)
                 memset(start, 0, n_chars);
         }
         vec->elem[slot] = new_elem;
+        gc_write_barrier(ob, new_elem);
         return ob;
 }
 